@@ -91,16 +91,21 @@ def main():
     
     bayes = Bayes(model, data, mumin, mumax)
     
+    # all percentiles are computed from the same tabulated cdf
     CL = 0.683
     CLlow = (1-CL)/2
     CLupp = (1+CL)/2
-    lowerlimit = bayes.percentile(CLlow)
-    upperlimit = bayes.percentile(CLupp)
+    prob = vector('double')()
+    for p in [CLlow, CLupp, CLupper]: prob.push_back(p)
+    lowerlimit, upperlimit, limit = bayes.percentiles(prob)
     print "=> central interval [%5.2f, %5.2f] (%4.1f%s) width = %5.2f" % \
       (lowerlimit, upperlimit, 100*CL, '%', upperlimit-lowerlimit)     
 
+    hpd = bayes.HPD(CL)
+    print "=> shortest interval [%5.2f, %5.2f] (%4.1f%s) width = %5.2f" % \
+      (hpd.first, hpd.second, 100*CL, '%', hpd.second-hpd.first)     
+
     CL = CLupper
-    limit = bayes.percentile(CL)
     print "=> upper limit: %5.2f (%2.0f%sCL)\t\ttime:  %8.3fs" % \
       (limit, 100*CL, '%', swatch.RealTime())
 
@@ -0,0 +1,62 @@
+#!/usr/bin/env python
+#-----------------------------------------------------------------------------
+# File:        swarm2bin.py
+#
+#              Convert a swarm text file to the binary format, which the
+#              models memory-map and use in place.
+#
+#              Example usage:
+#                 swarm2bin.py [-g] input-file output-file
+#
+#              -g  the input is a MultiPoissonGamma file (signals,
+#                  backgrounds, and their uncertainties); the default
+#                  is a MultiPoisson file (signals and backgrounds).
+#-----------------------------------------------------------------------------
+import os, sys
+from ROOT import *
+#-----------------------------------------------------------------------------
+def main():
+    # --------------------------------------
+    # load limit codes
+    # --------------------------------------
+    if os.environ.has_key('LIMITS_PATH'):
+        gSystem.AddDynamicPath("$LIMITS_PATH/lib")
+        gSystem.Load('liblimits')
+    else:
+        sys.exit('''
+    please do
+        cd ..
+        source setup.sh
+    to define environment variable LIMITS_PATH
+        ''')
+            
+    argv = sys.argv[1:]
+    gamma = '-g' in argv
+    argv = filter(lambda x: x != '-g', argv)
+    if len(argv) < 2:
+        sys.exit(USAGE)
+    infile, outfile = argv[:2]
+    if not os.path.exists(infile):
+        sys.exit("** can't find file %s" % infile)
+
+    swatch = TStopwatch()
+    swatch.Start()
+    if gamma:
+        model = MultiPoissonGamma(infile)
+    else:
+        model = MultiPoisson(infile)
+    print "=> read %d points from %s\t\ttime:  %8.3fs" % \
+      (model.size(), infile, swatch.RealTime())
+
+    model.writeBinary(outfile)
+    print "=> wrote %s" % outfile
+#-----------------------------------------------------------------------------
+USAGE = '''
+    Usage:
+       swarm2bin.py [-g] input-file output-file
+'''
+try:
+    main()
+    
+except KeyboardInterrupt:
+    print "ciao!"
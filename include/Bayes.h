@@ -17,9 +17,9 @@
 #include <vector>
 #include <string>
 #include "PDFunction.h"
+#include "CachedPDF.h"
 #include "PriorFunction.h"
 #include "LimitCalculator.h"
-#include "Math/Interpolator.h"
 #ifdef __WITH_ROOFIT__
 #include "PDFWrapper.h"
 #include "RooAbsPdf.h"
@@ -28,11 +28,33 @@
 #endif
 //--------------------------------------------------------------
 /** Compute Bayesian limits.
+    <p>
+    The posterior density is tabulated over its support, and the 
+    tabulation used to compute percentiles, when first needed. So a
+    calculator used only for MAP() or zvalue() never tabulates it. The
+    cdf is tabulated by adaptive Simpson integration, and interpolated
+    with cubic Hermite polynomials, so that its error is within a given
+    tolerance (see setTolerance()) using as few calculations of the 
+    likelihood as the shape of the posterior density allows. The slopes
+    of the polynomials are limited so that the interpolated cdf is 
+    monotonic, and can therefore be inverted, in O(log n) operations, 
+    to compute percentiles. 
+    <p>
+    After setData(), the posterior density is first tabulated over the
+    support found for the previous data, which is kept if it is still
+    adequate. For an ensemble of similar datasets, this needs a third 
+    as many likelihood calculations as finding the support afresh.
  */
 class Bayes : public LimitCalculator
 {
 public:
-  Bayes () {}
+  /// Default largest number of likelihood calculations per tabulation.
+  enum { MAXEVALUATIONS=10000 };
+
+  Bayes () : _pdf(0), _ownpdf(false), _nsteps(20), _tolerance(1.e-4),
+    _maxevaluations(MAXEVALUATIONS), _error(0), _nevaluations(0), 
+    _perror(0),
+    _warmstart(true), _tabulated(false) {}
 
   /** Compute Bayesian limits.
       @param model  - probability density function (pdf)
@@ -64,11 +86,21 @@ public:
   
   virtual ~Bayes();
 
+  /** Return a copy of this calculator with its own copy of the model,
+      or 0 if the model cannot be copied. Since a prior function may 
+      not be safe to call from several threads, 0 is also returned if 
+      a prior function was supplied.
+   */
+  LimitCalculator* clone();
+
   /**
    */
 
   PDFunction* pdf() {return _pdf;}
 
+  /// Return the cache through which the likelihood is computed.
+  CachedPDF* cache() {return &_cache;}
+
   /// Compute Bayesian Z=sign(B10)*sqrt(2*|B10|), where B10 is the Bayes factor.
   double zvalue(double mu=1);
 
@@ -80,9 +112,21 @@ public:
    */
   double uncertainty();
 
-  /// Compute percentile of posterior density.
+  /** Compute percentile of posterior density. This and the following
+      methods use the tabulated cdf, so they need no calculations of 
+      the likelihood once the posterior density has been tabulated.
+  */
   double percentile(double p=-1);
 
+  /// Compute percentiles of posterior density for several probabilities.
+  std::vector<double> percentiles(std::vector<double>& p);
+
+  /** Compute the shortest interval that contains a fraction cl_ of the
+      posterior probability, that is, the highest posterior density 
+      interval if the posterior density has a single mode.
+  */
+  std::pair<double, double> HPD(double cl_=0.683);
+
   //======================================================================
   
   /** Compute prior.
@@ -93,6 +137,10 @@ public:
    */  
   double likelihood(double poi);
 
+  /** Compute log-likelihood.
+   */  
+  double logLikelihood(double poi);
+
   /** Compute normalization of posterior density.
    */  
   double normalize();
@@ -101,18 +149,84 @@ public:
    */  
   double posterior(double poi);
 
+  /** Compute log of posterior density at specified value of 
+      parameter of interest.
+   */  
+  double logPosterior(double poi);
+
   /// Compute cdf of posterior density.
   double cdf(double poi);
 
-  /// Compute MAximum Posterior estimate (mode of posterior density).
+  /** Compute MAximum Posterior estimate (mode of posterior density).
+      The mode is searched for within the bounds given to the 
+      constructor, so it does not depend on the support found for
+      previous data.
+  */
   std::pair<double, double> MAP(double cl_=0.683);
   
+  /** Set the data. The posterior density is tabulated again when
+      next needed.
+  */
   void setData(std::vector<double>& d);
+
+  /// Discard the cached likelihoods (see CachedPDF) and the results.
+  void clearCache();
+
+  /** Set the largest error allowed in the tabulated cdf of the 
+      posterior density, that is, in the probability content of the
+      percentiles (default: 1e-4).
+  */
+  void setTolerance(double tolerance) 
+  { 
+    _tolerance = tolerance; 
+    _normalize = true;
+  }
+
+  /** Set the largest number of likelihood calculations made by one
+      tabulation of the posterior density (default: MAXEVALUATIONS).
+      If the tolerance is not reached within it, as may happen for a
+      posterior density with a discontinuity, the remaining panels 
+      are accepted as they are and error() exceeds the tolerance.
+  */
+  void setMaxEvaluations(int maxevaluations)
+  {
+    _maxevaluations = maxevaluations;
+    _normalize = true;
+  }
+
+  /// Return the estimated error in the tabulated cdf.
+  double error()
+  {
+    if ( _normalize ) normalize();
+    return _error;
+  }
+
+  /// Return the estimated error in the last percentile computed.
+  double percentileError() { return _perror; }
+
+  /** Return the number of likelihood calculations made by the last
+      tabulation of the posterior density. Values found in the cache
+      of likelihoods (see CachedPDF) are not counted.
+  */
+  int nevaluations() { return _nevaluations; }
+
+  /** If true (the default), tabulate the posterior density for new
+      data starting from the support found for the previous data.
+      Otherwise, find the support afresh.
+  */
+  void setWarmStart(bool yes=true) { _warmstart = yes; }
+
+  /** Find the support and the mode for the next data afresh, rather
+      than starting from those for the current data.
+  */
+  void reset();
   
   std::vector<double>& data() {return _data;}
 
+  ///
   std::pair<double, double> support()
   {
+    if ( _normalize ) normalize();
     return std::pair<double, double>(_poimin, _poimax);
   }
   
@@ -120,9 +234,12 @@ public:
 
 private:
   PDFunction*    _pdf;
+  CachedPDF      _cache;
   std::vector<double> _data;
-  double _poimin;
+  double _poimin;       // current support
   double _poimax;
+  double _poilower;     // bounds given to the constructor
+  double _poiupper;
   double _cl;
   PriorFunction* _prior;
 #ifdef __WITH_ROOFIT__
@@ -130,20 +247,33 @@ private:
   RooRealVar*    _rfpoi;
 #endif
   bool   _normalize;
+  bool   _ownpdf;
   
-  ROOT::Math::Interpolator* _interp;  
   int _nsteps;
-  std::vector<double> _x;
-  std::vector<double> _y;
+  std::vector<double> _x;    // tabulation points
+  std::vector<double> _y;    // cdf at tabulation points
+  std::vector<double> _f;    // posterior density at tabulation points
+  std::vector<double> _d;    // slopes of interpolated cdf
+  double _tolerance;
+  int    _maxevaluations;
+  double _error;
+  int    _nevaluations;
+  double _perror;
   
   double _normalization;
+  double _lnnormalization;
   double _likeprior(double poi);
-  double _q(double prob);
-  double _f(double prob);
+  double _loglikeprior(double poi);
+  void   _loglikeprior(std::vector<double>& poi, std::vector<double>& lnp);
+  double _cdf(double poi);
+  double _inverse(double prob);
+  double _density(double poi);
   double _nsig;
   bool   _MAPdone;
   std::pair<double, double> _result;
   int    _verbosity;
+  bool   _warmstart;
+  bool   _tabulated;   // true if support found by a previous tabulation
 };
 
 #endif
@@ -0,0 +1,90 @@
+#ifndef BRENTMINIMIZER_H
+#define BRENTMINIMIZER_H
+//--------------------------------------------------------------
+// File: BrentMinimizer.h
+// Description: Reentrant minimizer of a function of one variable
+//              on a bounded interval. Unlike TMinuit, it uses no
+//              global state, so several minimizations can run at
+//              the same time in different threads.
+//--------------------------------------------------------------
+#include <functional>
+
+/** Minimize a function of one variable on the interval [xmin, xmax].
+    <p>
+    If only the function is available, the minimum is first bracketed 
+    by walking downhill from a starting point, with a step that doubles
+    at each move, and then located with Brent's method (parabolic 
+    interpolation safeguarded by golden section search). When the 
+    starting point is close to the minimum, e.g., the result of a 
+    previous fit, the bracket is small and few function calls are 
+    needed.
+    <p>
+    If the first and second derivatives are available, a Newton 
+    iteration safeguarded by bisection is used instead.
+ */
+class BrentMinimizer
+{
+public:
+  /** 
+      @param xmin      - lower bound
+      @param xmax      - upper bound
+      @param tolerance - absolute tolerance on the position of the 
+                         minimum (default: 1e-8 * (xmax - xmin))
+      @param maxiter   - maximum number of iterations
+  */
+  BrentMinimizer(double xmin, double xmax, double tolerance=-1, 
+		 int maxiter=500);
+
+  ///
+  ~BrentMinimizer() {}
+
+  /** Minimize f.
+      @param f     - function to be minimized
+      @param guess - starting point
+      @param step  - initial step (default: (xmax - xmin)/100)
+      @return 0 if successful
+  */
+  int minimize(const std::function<double(double)>& f, 
+	       double guess, double step=-1);
+
+  /** Minimize a function given its value and first and second
+      derivatives, which fdf(x, f, df, d2f) must compute.
+      @param fdf   - function and its derivatives
+      @param guess - starting point
+      @return 0 if successful
+  */
+  int minimize(const std::function<void(double, double&, double&, 
+					double&)>& fdf, 
+	       double guess);
+
+  /// Location of minimum.
+  double x() const { return _x; }
+
+  /// Function value at minimum.
+  double fval() const { return _fval; }
+
+  /** Second derivative of the function at the minimum. If derivatives
+      were not supplied, this is computed by finite differences, with
+      a step scaled to the width of the minimum.
+  */
+  double curvature() const { return _curvature; }
+
+  /// Number of function calls made by the last minimization.
+  int ncalls() const { return _ncalls; }
+
+private:
+  double _xmin;
+  double _xmax;
+  double _tolerance;
+  int    _maxiter;
+  double _x;
+  double _fval;
+  double _curvature;
+  int    _ncalls;
+
+  // second difference of f at x, with step h
+  double difference(const std::function<double(double)>& f,
+		    double x, double fx, double h);
+};
+
+#endif
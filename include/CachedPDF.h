@@ -0,0 +1,137 @@
+#ifndef CACHEDPDF_H
+#define CACHEDPDF_H
+//--------------------------------------------------------------
+// File: CachedPDF.h
+// Description: A PDFunction that remembers the log-likelihoods
+//              computed by another, so that the values revisited
+//              by fits and root finding are computed only once.
+//--------------------------------------------------------------
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include "PDFunction.h"
+
+/** Cache the log-likelihoods computed by a model.
+    <p>
+    The values are keyed by a dataset version and the value of the
+    parameter of interest. The version changes whenever the likelihood
+    is requested for data different from those of the previous request,
+    or when clear() is called, at which point the cached values are
+    discarded. Call clear() if the model itself changes, for example,
+    after MultiPoisson::profile() or MultiPoisson::set().
+    <p>
+    Wald and Bayes wrap their models in a CachedPDF and clear it in
+    setData(), so that, e.g., the repeated calls to nll(poihat) in
+    Wald::percentile() cost nothing. If their model is changed instead
+    of the data, e.g., by adding points to its swarm or by changing
+    its parameters, call their clearCache(), otherwise the likelihoods
+    computed for the old model are reused. The model may also be 
+    wrapped explicitly,
+    \code
+    MultiPoisson model("swarm.dat");
+    CachedPDF cached(model);
+    Wald wald(cached, data, 0, 10);
+      :
+    cout << cached.hits() << " hits, " << cached.misses() << " misses"
+         << endl;
+    \endcode
+    The cache is reentrant if the model is.
+*/
+class CachedPDF : public PDFunction
+{
+ public:
+  /// Default size of the cache.
+  enum { MAXSIZE=1 << 16 };
+
+  ///
+  CachedPDF();
+
+  /**
+      @param model   - model whose log-likelihoods are cached
+      @param maxsize - the cache is cleared when it has this many values
+  */
+  CachedPDF(PDFunction& model, int maxsize=MAXSIZE);
+
+  /// The copy shares the model and starts with a copy of the cache.
+  CachedPDF(const CachedPDF& other);
+
+  ///
+  CachedPDF& operator=(const CachedPDF& other);
+
+  ///
+  virtual ~CachedPDF();
+
+  /// Generate data using the model.
+  std::vector<double>& generate(double poi);
+
+  /// Return the Asimov dataset of the model.
+  std::vector<double> asimov(double poi) 
+  { return _model ? _model->asimov(poi) : std::vector<double>(); }
+
+  /// Compute likelihood.
+  double operator() (std::vector<double>& data, double poi);
+
+  /// Compute log-likelihood, or return the cached value.
+  double logLikelihood(std::vector<double>& data, double poi);
+
+  /** Compute likelihood at several values of poi. The values that
+      are not in the cache are computed by the model in one call.
+  */
+  void evaluate(std::vector<double>& data,
+		std::vector<double>& poi,
+		std::vector<double>& result,
+		bool uselog=false);
+
+  /// Compute derivatives using the model; these are not cached.
+  bool derivatives(std::vector<double>& data, double poi,
+		   double& lnL, double& d1, double& d2)
+  { return _model ? _model->derivatives(data, poi, lnL, d1, d2) : false; }
+
+  ///
+  bool reentrant() { return _model ? _model->reentrant() : false; }
+
+  /// Return a cache of a copy of the model, or 0 if it cannot be copied.
+  PDFunction* clone();
+
+  ///
+  void setSeed(int seed) { if ( _model ) _model->setSeed(seed); }
+
+  ///
+  void setStream(long stream) { if ( _model ) _model->setStream(stream); }
+
+  /// Generate datasets using the model.
+  void generateBatch(double poi, int ntoys, std::vector<double>& data,
+		     long firststream=0)
+  { if ( _model ) _model->generateBatch(poi, ntoys, data, firststream); }
+
+  /// Discard the cached values and start a new dataset version.
+  void clear();
+
+  ///
+  PDFunction* model() { return _model; }
+
+  /// Return the dataset version.
+  long version() { return _version; }
+
+  /// Number of values found in the cache.
+  long hits() { return _hits; }
+
+  /// Number of values computed by the model.
+  long misses() { return _misses; }
+
+ private:
+  PDFunction* _model;
+  bool   _ownmodel;
+  int    _maxsize;
+  long   _version;
+  long   _hits;
+  long   _misses;
+  std::vector<double> _data;
+  std::unordered_map<double, double> _table;
+  std::mutex _lock;
+
+  long _lookup(std::vector<double>& data);
+  void _insert(long version, double poi, double lnp);
+};
+
+#endif
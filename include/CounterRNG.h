@@ -0,0 +1,115 @@
+#ifndef COUNTERRNG_H
+#define COUNTERRNG_H
+//--------------------------------------------------------------
+// File: CounterRNG.h
+// Description: Counter-based random number generator with
+//              independent, reproducible streams.
+//--------------------------------------------------------------
+#include <stdint.h>
+
+/** A counter-based random number generator (Philox4x32-10; J. Salmon
+    et al., "Parallel random numbers: as easy as 1, 2, 3", SC11).
+    <p>
+    The n-th block of four 32-bit numbers of a stream is a bijection,
+    keyed by the seed, of the counter (stream, n). There is no other
+    state, so a stream can be started anywhere, and distinct streams
+    are independent. The models use one stream per toy, which makes it
+    possible to regenerate any toy in isolation,
+    \code
+    model.setSeed(seed);
+    model.setStream(toy);
+    vector<double>& data = model.generate(mu);
+    \endcode
+    and makes the toys independent of how they are divided among
+    threads or jobs.
+    <p>
+    The numbers are computed BUFFERSIZE at a time. When many toys are
+    generated together, one generator per toy, the static samplers 
+    first top up the buffers of all the generators at once, computing
+    the blocks of several generators in parallel with SIMD 
+    instructions, and then draw one variate from each generator. The
+    variates are the same as those drawn one generator at a time.
+ */
+class CounterRNG
+{
+public:
+  /// Number of 32-bit numbers computed at a time.
+  enum { BUFFERSIZE=16 };
+
+  ///
+  CounterRNG(uint64_t seed=0, uint64_t stream=0);
+
+  ///
+  ~CounterRNG() {}
+
+  /// Set the seed and restart the current stream.
+  void setSeed(uint64_t seed);
+
+  /// Start stream at its beginning.
+  void setStream(uint64_t stream);
+
+  ///
+  uint64_t seed() const { return _seed; }
+
+  ///
+  uint64_t stream() const { return _stream; }
+
+  /// Return the next 32-bit random number of the stream.
+  uint32_t next()
+  {
+    if ( _index == _size ) _refill();
+    return _buffer[_index++];
+  }
+
+  /// Return a uniform variate in (0, 1).
+  double uniform()
+  {
+    uint64_t x = ((uint64_t)next() << 32) | next();
+    return ((x >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+  }
+
+  /// Return an integer uniformly distributed in [0, n-1].
+  int integer(int n);
+
+  /// Return a Gaussian variate of zero mean and unit variance.
+  double gaus();
+
+  /// Return a gamma variate of given shape and scale.
+  double gamma(double shape, double scale=1);
+
+  /// Return a Poisson variate of given mean.
+  double poisson(double mean);
+
+  /// Compute the Philox4x32-10 block for a counter and a key.
+  static void philox(const uint32_t counter[4], const uint32_t key[2],
+		     uint32_t block[4]);
+
+  /// Fill the buffers of generators rng[0],..., rng[n-1].
+  static void fill(int n, CounterRNG* rng);
+
+  /** Draw a gamma variate from each of n generators:
+      x[t] = rng[t].gamma(shape[t], scale[t]).
+   */
+  static void gamma(int n, CounterRNG* rng, 
+		    const double* shape, const double* scale, double* x);
+
+  /// Draw a Poisson variate from each of n generators.
+  static void poisson(int n, CounterRNG* rng, 
+		      const double* mean, double* k);
+
+private:
+  uint64_t _seed;
+  uint64_t _stream;
+  uint64_t _counter;    // number of blocks used in the stream
+  uint32_t _buffer[BUFFERSIZE];
+  int      _index;      // next number in _buffer
+  int      _size;       // number of numbers in _buffer
+  bool     _hasgaus;    // true if _gaus is unused
+  double   _gaus;
+
+  void _refill();
+  double _gammaLoop(double d, double c);
+  double _ptrsLoop(double mean, double u, double v);
+};
+
+#endif
@@ -15,17 +15,77 @@
 //--------------------------------------------------------------
 /** Compute expected limits.
     <p>
-    Generate 
+    Generate an ensemble of data sets, compute a limit for each, and
+    return the requested quantiles of the distribution of limits.
+    <p>
+    If the calculator can be cloned (see LimitCalculator::clone), the 
+    ensemble is split into contiguous blocks of toys, one per thread
+    of the ThreadPool, each of which uses its own calculator. Each toy
+    is generated from its own random number stream, keyed by the seed
+    and the index of the toy (see PDFunction::setStream), so the toys
+    do not depend on the number of threads or on how they are 
+    scheduled. Nor do the limits: a calculator that starts from its
+    results for the previous toy is reset (see LimitCalculator::reset)
+    every few toys, at toys fixed by their indices. Each thread 
+    generates its toys several at a time (see 
+    PDFunction::generateBatch).
+    <p>
+    The quantiles are tracked as the limits are computed (see
+    StreamingQuantiles), so the memory needed does not grow with the 
+    size of the ensemble. If a tolerance is set (see setTolerance), 
+    the ensemble is generated in rounds of ROUNDSIZE toys and 
+    stops, before the ensemble size is reached, as soon as the 
+    estimated Monte Carlo uncertainty of every quantile is below the 
+    tolerance. The median typically needs far fewer toys than the 
+    edges of the 2-sigma band.
+    <p>
+    An ensemble can also be split into shards (see setShard), each of
+    which generates a contiguous range of the toys and can run as a 
+    separate job. Since the toys are keyed by their indices, they do 
+    not depend on the number of shards either. A shard saves its 
+    limits to a checkpoint file after each round of ROUNDSIZE toys, 
+    and resumes from the file if it is rerun after an interruption. 
+    The shards are then combined with merge(), e.g.,
+    \code
+    // job i of 10
+    ExpectedLimits expected(calculator, 5000);
+    expected.setShard(i, 10, Form("shard%d.lim", i));
+    expected(mu);
+       :
+    // when all jobs are done
+    vector<string> files = ...;
+    vector<double> limits = expected.merge(files);
+    \endcode
+    <p>
+    In Asimov mode (see setAsimov), no ensemble is generated. Instead,
+    the limit is computed once, for the Asimov dataset of the model
+    (see PDFunction::asimov), and the quantiles follow from the 
+    asymptotic formulas of Cowan, Cranmer, Gross, and Vitells, 
+    arXiv:1007.1727. If \f$\mu_{med}\f$ is the limit for the Asimov
+    dataset, \f$\hat{\mu}\f$ the estimate, and \f$\mu'\f$ the
+    true value, the quantile with probability \f$p\f$ is
+    \f[
+    \mu' + (\mu_{med} - \hat{\mu}) + \sigma \, \Phi^{-1}(p), \quad 
+    \sigma^2 = (\mu_{med} - \hat{\mu})^2 / q_A(\mu_{med}),
+    \f]
+    where \f$q_A(\mu) = 2 \ln L(\hat{\mu}) / L(\mu)\f$ is computed 
+    from the Asimov dataset. Ideally, \f$\hat{\mu} = \mu'\f$, but
+    averaging over a swarm can bias the estimate. The formulas are 
+    exact, asymptotically, for the Wald calculator, and an 
+    approximation for Bayes.
  */
 class ExpectedLimits
 {
 public:
+  /// Number of toys between checks of the tolerance.
+  enum { ROUNDSIZE=100 };
+
   static std::vector<double> dummy;
   
   ExpectedLimits();
 
   /** Compute quantiles of limits distribution, generated internally.
-      @param ensemble size - size of ensemble of limits
+      @param ensemble size - (maximum) size of ensemble of limits
       @param calculator  - limit calculator (Bayes or Wald)
   */
   ExpectedLimits(LimitCalculator& calculator,
@@ -40,15 +100,68 @@ public:
 					  bool compute_rms=true);
   virtual double rms()  { return _rms; }
   virtual double bias() { return _bias; }
+
+  /// Set the seed of the random number streams of the toys.
+  virtual void setSeed(int seed) { _seed = seed; }
+
+  /** If true, compute the quantiles from the Asimov dataset rather
+      than from an ensemble. Then rms() returns the asymptotic standard
+      deviation of the estimate, and bias() the bias of the estimate 
+      for the Asimov dataset. The Asimov limit is computed with a copy
+      of the calculator, whose data are therefore left unchanged.
+   */
+  virtual void setAsimov(bool yes=true) { _asimov = yes; }
+
+  /** Stop generating toys once the Monte Carlo uncertainty of every
+      quantile is less than tolerance (in the units of the limit).
+      The default, 0, generates the whole ensemble.
+   */
+  virtual void setTolerance(double tolerance) { _tolerance = tolerance; }
+
+  ///
+  virtual double tolerance() { return _tolerance; }
+
+  /// Number of toys generated by the last call.
+  virtual int ntoys() { return _ntoys; }
+
+  /// Estimated Monte Carlo uncertainties of the last quantiles.
+  virtual std::vector<double> errors() { return _errors; }
+
+  /** Generate only shard shard (0,...,nshards-1) of the ensemble and
+      checkpoint its limits to the file checkpoint. If the file 
+      exists, the toys it contains are not regenerated. The tolerance
+      is not used for a shard. Set nshards to 0 to generate the whole
+      ensemble. It is an error if shard is out of range or if the 
+      checkpoint file cannot be written.
+   */
+  virtual void setShard(int shard, int nshards, std::string checkpoint);
+
+  /** Return the quantiles of the limits in the checkpoint files of
+      the shards of an ensemble. Then rms(), bias(), ntoys(), and
+      errors() refer to the merged ensemble. It is an error if the
+      files are from different runs, or if a shard is missing or 
+      given more than once.
+   */
+  virtual std::vector<double> merge(const std::vector<std::string>& 
+				    filenames);
   
 private:
   LimitCalculator* _calculator;
   int _ensemblesize;
+  int _seed;
   std::vector<double> _prob;
-  std::vector<double> _limit;
   double _rms;
   double _bias;
   int _debuglevel;
+  bool _asimov;
+  double _tolerance;
+  int _ntoys;
+  std::vector<double> _errors;
+  int _shard;
+  int _nshards;
+  std::string _checkpoint;
+
+  std::vector<double> _asimovLimits(double true_value);
 };
 
 #endif
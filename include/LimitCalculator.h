@@ -38,6 +38,18 @@ public:
 
   /// Compute estimate
   virtual double estimate()=0;  
+
+  /** Return a copy of this calculator, with its own copy of the 
+      model, allocated with new. Return 0 if the calculator 
+      cannot be copied.
+  */
+  virtual LimitCalculator* clone() { return 0; }
+
+  /** Forget the results for the previous data, from which the 
+      calculations for new data may otherwise be started, so that the
+      results for the next data depend on those data only.
+  */
+  virtual void reset() {}
 };
 
 #endif
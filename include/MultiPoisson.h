@@ -17,13 +17,24 @@
 //          25-May-2017 HBP - use S and B instead of efl and bkg!
 //--------------------------------------------------------------
 #include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
 #include <algorithm>
-#include "TRandom3.h"
+#include "CounterRNG.h"
 #include "PDFunction.h"
 
+class SwarmFile;
+class SwarmReader;
+
 /** Implement the multi-Poisson model averaged over an evidence-based prior.
     The evidence-based prior is given as a swarm of points over signal and
     backgrounds.
+    <p>
+    The swarm can be read from a text file or from a binary file 
+    written by writeBinary(). A binary file is memory-mapped and used
+    in place, so it is loaded almost instantly whatever its size.
 */
 class MultiPoisson : public PDFunction
 {
@@ -33,9 +44,20 @@ class MultiPoisson : public PDFunction
 
   /** Default constructor.  
       @param filename - name of text file containing counts, effective
-      luminosities, and backgrounds.
+      luminosities, and backgrounds, or of a binary file written by
+      writeBinary().
   */
   MultiPoisson(std::string filename);
+
+  /** Read the counts and the first sampled points from a text file.
+      The points are decoded a chunk at a time, so the memory needed
+      beyond the model itself is bounded. More points can be added 
+      later with read().
+      @param reader  - text file positioned at its first record
+      @param npoints - maximum number of points to read 
+      (default: the number given in the file)
+  */
+  MultiPoisson(SwarmReader& reader, int npoints=-1);
  
   
   /** Main constructor. 
@@ -43,6 +65,12 @@ class MultiPoisson : public PDFunction
   */
   MultiPoisson(std::vector<double>& N);
  
+  ///
+  MultiPoisson(const MultiPoisson& other);
+
+  ///
+  MultiPoisson& operator=(const MultiPoisson& other);
+
   ///
   virtual ~MultiPoisson();
 	     
@@ -50,6 +78,22 @@ class MultiPoisson : public PDFunction
       @param mu - parameter of interest
   */
   std::vector<double>& generate(double mu);
+
+  /** Generate ntoys experiments from streams firststream,...,
+      firststream + ntoys-1, the counts of all the toys being sampled 
+      together, bin by bin.
+      @param mu          - parameter of interest
+      @param ntoys       - number of experiments
+      @param data        - counts, ntoys x nbins
+      @param firststream - stream of the first experiment
+  */
+  void generateBatch(double mu, int ntoys, std::vector<double>& data,
+		     long firststream=0);
+
+  /** Return the Asimov dataset, mu * S + B averaged over the swarm.
+      @param mu - parameter of interest
+  */
+  std::vector<double> asimov(double mu);
   
   /** Compute likelihood.
       @param N - observed data
@@ -62,8 +106,57 @@ class MultiPoisson : public PDFunction
   */
   double operator() (double mu);
 
-  /** If true, profile rather than average.
-      Not yet implemented.
+  /** Compute log-likelihood. The swarm average is computed using the
+      log-sum-exp trick so that models with many bins do not underflow.
+      @param N - observed data
+      @param mu - parameter of interest 
+  */
+  double logLikelihood(std::vector<double>& N, double mu);
+
+  /** Compute log-likelihood using internally cached data.
+      @param  mu - value of parameter of interest 
+  */
+  double logLikelihood(double mu);
+
+  /** Compute likelihood at several values of mu. The swarm is 
+      traversed once for all values of mu.
+      @param N      - observed data
+      @param mu     - values of parameter of interest
+      @param result - likelihoods 
+      @param uselog - if true, return log-likelihoods
+  */
+  void evaluate(std::vector<double>& N, 
+		std::vector<double>& mu,
+		std::vector<double>& result, 
+		bool uselog=false);
+
+  /** Compute log-likelihood and its first and second derivatives 
+      with respect to mu. The derivatives of the average over the 
+      swarm are averages of the derivatives of the points weighted by
+      their likelihoods. When profiling, they are the derivatives of
+      the point at the maximum.
+      @param N   - observed data
+      @param mu  - parameter of interest 
+      @param lnL - log-likelihood
+      @param d1  - first derivative
+      @param d2  - second derivative
+  */
+  bool derivatives(std::vector<double>& N, double mu,
+		   double& lnL, double& d1, double& d2);
+
+  /// The likelihood may be computed from several threads at once.
+  bool reentrant() { return true; }
+
+  /// Return a copy of this model.
+  PDFunction* clone() { return new MultiPoisson(*this); }
+
+  /** If true, profile rather than average, that is, return the
+      maximum of the likelihood over the swarm. The point at the 
+      maximum is remembered, and, since the likelihood of each point
+      is concave in mu, the tangents computed at one value of mu bound
+      the likelihoods at nearby values. Only points whose bound exceeds
+      the likelihood of the remembered point are computed, which makes
+      the repeated evaluations of fits and root finding cheap.
    */
   void profile(bool yes=true) {_profile=yes;}
 
@@ -73,6 +166,15 @@ class MultiPoisson : public PDFunction
    */
   void add(std::vector<double>& S, std::vector<double>& B);
 
+  /** Add the next sampled points from a text file, a chunk at a time,
+      and update the mean signals and backgrounds.
+      @param reader  - text file positioned at a sampled point
+      @param npoints - maximum number of points to read
+      @return number of points read, fewer than npoints only at the
+      end of the file
+  */
+  int read(SwarmReader& reader, int npoints);
+
   /** Update specified signal parameter point.
    */
   void update(int ii, std::vector<double>& S);
@@ -80,11 +182,22 @@ class MultiPoisson : public PDFunction
   /** Compute mean signals and backgrounds.
    */
   void computeMeans();
+
+  /** Write the observed counts and the swarm to a binary file, which
+      can be read back by MultiPoisson(filename). The file contains 
+      the sections N, S, B, sum of S per point, sum of B per point, 
+      mean S, and mean B, where S and B are the bins x points matrices
+      described in the header.
+  */
+  void writeBinary(std::string filename);
   
   void set(int ii);
   void reset();
   void setSeed(int seed);
 
+  /// Start the random number stream (e.g., the index of a toy).
+  void setStream(long stream);
+
   ///
   //std::vector<std::pair<double, double> > get(int ii);
 
@@ -98,20 +211,69 @@ class MultiPoisson : public PDFunction
   std::vector<double> background() { return _meanB; }
 
   /// Return sample size.
-  int size() { return _S.size(); }
+  int size() { return _npoints; }
   
  private:
     std::vector<double> _N;
     std::vector<double> _Ngen;
-    std::vector<std::vector<double> > _S;
-    std::vector<std::vector<double> > _B;
+
+    // The swarm is stored as two bins x points matrices, one for the
+    // signals and one for the backgrounds. The parameters of point k
+    // in bin i are at [i * _stride + k], so that the likelihood can be
+    // computed for many points at once. _stride >= _npoints is the
+    // allocated number of points per bin.
+    std::vector<double> _S;
+    std::vector<double> _B;
+    std::vector<double> _sumS;
+    std::vector<double> _sumB;
     std::vector<double> _meanS;
     std::vector<double> _meanB;
     
-    TRandom3 _random;
+    CounterRNG _random;
     int _nbins;
+    int _npoints;
+    int _stride;
     int _index;
     bool _profile;
+
+    // The swarm is read through these pointers, which point either to
+    // the vectors above or into a memory-mapped binary file. A mapped
+    // swarm is copied into the vectors before it is modified.
+    const double* _pS;
+    const double* _pB;
+    const double* _psumS;
+    const double* _psumB;
+    std::shared_ptr<SwarmFile> _file;
+
+    void _readText(SwarmReader& reader, int npoints);
+    void _readBinary(std::string filename);
+    void _repoint();
+    void _unmap();
+    void _reserve(int npoints);
+    void _logLikelihoods(std::vector<double>& N, std::vector<double>& mu,
+			 int first, int npoints, double* lnp);
+
+    // For profiling: the log-likelihood of every point and its slope
+    // with respect to mu, at the value of mu for which the cache was
+    // built. As in MultiPoissonGamma, a cache is never modified once
+    // built.
+    struct ProfileCache
+    {
+      std::vector<double> counts;    // counts for which cache was built
+      double mu;
+      int kmax;                      // point with largest likelihood
+      std::vector<double> lnp;       // +inf if the tangent is undefined
+      std::vector<double> slope;
+    };
+    std::shared_ptr<const ProfileCache> _profilecache;
+    std::mutex _cachelock;
+    std::atomic<int> _argmax;        // point at last maximum
+
+    std::shared_ptr<const ProfileCache> 
+    _profileCache(std::vector<double>& N, double mu, bool rebuild=false);
+    double _profileLogLikelihood(std::vector<double>& N, double mu,
+				 int& kbest);
+    double _logLikelihood(std::vector<double>& N, double mu, int k);
 };
 
 #endif
@@ -14,11 +14,18 @@
 //          25-May-2017 HBP - use S and B instead of efl and bkg!
 //--------------------------------------------------------------
 #include <vector>
+#include <string>
 #include <algorithm>
-#include "TRandom3.h"
+#include <memory>
+#include <mutex>
+#include <atomic>
 #include "PDFunction.h"
 #include "MultiPoissonGammaModel.h"
 
+class SwarmFile;
+class SwarmReader;
+class TFile;
+
 /** Implement the MultiPoissonGammaModel averaged over an evidence-based prior.
    <p>
    The class computes
@@ -32,6 +39,13 @@
    as a swarm of \f$K\f$ sampled points \f$\{(x_i, y_i, a_i, b_i)\}\f$. The
    parameters \f$x\f$ and \f$y\f$ are the signals and backgrounds, respectively,
    with associated scale factors  \f$a\f$, and \f$b\f$. 
+   <p>
+   The observed counts are stored once and the parameters of the
+   swarm are stored in contiguous arrays, point by point, so that
+   computing the likelihood streams through memory. The probability 
+   of each bin is computed by MultiPoissonGammaModel::logProbability.
+   The swarm can also be read from a binary file written by 
+   writeBinary(), which is memory-mapped and used in place.
 */
 class MultiPoissonGamma : public PDFunction
 {
@@ -40,15 +54,32 @@ class MultiPoissonGamma : public PDFunction
   MultiPoissonGamma();
 
   /** 
-      @param filename - name of text file containing counts, or histogram names.
+      @param filename - name of text file containing counts, or histogram 
+      names, or of a binary file written by writeBinary().
   */
   MultiPoissonGamma(std::string filename);
+
+  /** Read the counts and the first sampled points from a text file.
+      The points are decoded a chunk at a time, so the memory needed
+      beyond the model itself is bounded. More points can be added 
+      later with read().
+      @param reader  - text file positioned at its first record
+      @param npoints - maximum number of points to read 
+      (default: the number given in the file)
+  */
+  MultiPoissonGamma(SwarmReader& reader, int npoints=-1);
   
   /** 
       @Param N - observed counts
   */
   MultiPoissonGamma(std::vector<double>& N);
   
+  ///
+  MultiPoissonGamma(const MultiPoissonGamma& other);
+
+  ///
+  MultiPoissonGamma& operator=(const MultiPoissonGamma& other);
+
   ///
   virtual ~MultiPoissonGamma();
 	     
@@ -56,6 +87,24 @@ class MultiPoissonGamma : public PDFunction
       @param mu - signal strength (parameter of interest)
   */
   std::vector<double>& generate(double mu);
+
+  /** Generate ntoys experiments from streams firststream,...,
+      firststream + ntoys-1, the efficiencies, backgrounds and counts
+      of all the toys being sampled together, bin by bin.
+      @param mu          - signal strength (parameter of interest)
+      @param ntoys       - number of experiments
+      @param data        - counts, ntoys x nbins
+      @param firststream - stream of the first experiment
+  */
+  void generateBatch(double mu, int ntoys, std::vector<double>& data,
+		     long firststream=0);
+
+  /** Return the Asimov dataset, the mean of mu * epsilon + background 
+      over the gamma priors and the swarm. The means are not rounded
+      (see MultiPoissonGammaModel::logProbability).
+      @param mu - signal strength (parameter of interest)
+  */
+  std::vector<double> asimov(double mu);
   
   /** Compute likelihood.
       @param N - observed data
@@ -68,8 +117,52 @@ class MultiPoissonGamma : public PDFunction
   */
   double operator() (double mu);
 
-  /** If true, profile rather than average.
-      Not yet implemented.
+  /** Compute log-likelihood. The swarm average is computed using the
+      log-sum-exp trick so that models with many bins do not underflow.
+      @param N - observed data
+      @param mu - signal strength (parameter of interest)
+  */
+  double logLikelihood(std::vector<double>& N, double mu);
+
+  /** Compute log-likelihood using internally cached data.
+      @param mu - signal strength (parameter of interest) 
+  */
+  double logLikelihood(double mu);
+
+  /** Compute likelihood at several values of mu, traversing the
+      swarm once for all values.
+      @param N      - observed data
+      @param mu     - values of signal strength
+      @param result - likelihoods 
+      @param uselog - if true, return log-likelihoods
+  */
+  void evaluate(std::vector<double>& N, 
+		std::vector<double>& mu,
+		std::vector<double>& result, 
+		bool uselog=false);
+
+  /** Compute log-likelihood and its first and second derivatives
+      with respect to mu (see MultiPoisson::derivatives).
+      @param N   - observed data
+      @param mu  - signal strength (parameter of interest)
+      @param lnL - log-likelihood
+      @param d1  - first derivative
+      @param d2  - second derivative
+  */
+  bool derivatives(std::vector<double>& N, double mu,
+		   double& lnL, double& d1, double& d2);
+
+  /// The likelihood may be computed from several threads at once.
+  bool reentrant() { return true; }
+
+  /// Return a copy of this model.
+  PDFunction* clone() { return new MultiPoissonGamma(*this); }
+
+  /** If true, profile rather than average, that is, return the
+      maximum of the likelihood over the swarm. The search starts from
+      the point at the last maximum, so that the repeated evaluations
+      of fits and root finding, at nearby values of mu, abandon most
+      points after a few bins.
    */
   void profile(bool yes=true) {_profile=yes;}
 
@@ -80,15 +173,14 @@ class MultiPoissonGamma : public PDFunction
       @param dbkg - background uncertainties
 
      <p>
-     This class uses MultiPoissonGammaModel, which requires
+     The Poisson-gamma model requires
      counts \f$x\f$ and \f$y\f$ and their associated
       scale factors \f$a\f$ and \f$b\f$, respectively, that define
       the gamma priors for the backgrounds and signals.
       However, often the evidence-based prior is specified as
       estimates in the form \f$c \pm \delta c\f$ for the background
       and signals. The add method converts these 
-      estimates into effective counts and scale factors and then
-      instantiates a MultiPoissonGammaModel.
+      estimates into effective counts and scale factors.
       <p>
       Consider the backgrounds.
       An effective count \f$y\f$ and scale factor \f$b\f$ is found by
@@ -119,6 +211,14 @@ class MultiPoissonGamma : public PDFunction
   void add(std::vector<double>& sig, std::vector<double>& dsig,
 	   std::vector<double>& bkg, std::vector<double>& dbkg);
 	   
+  /** Add the next sampled points from a text file, a chunk at a time.
+      @param reader  - text file positioned at a sampled point
+      @param npoints - maximum number of points to read
+      @return number of points read, fewer than npoints only at the
+      end of the file
+  */
+  int read(SwarmReader& reader, int npoints);
+
   ///
   void update(int ii, std::vector<double>& sig, std::vector<double>& dsig);
 
@@ -128,30 +228,93 @@ class MultiPoissonGamma : public PDFunction
   ///
   void reset();
 
-  ///
+  /** Seed the generator, which is used both to pick a sampled point
+      and to generate the counts.
+   */
   void setSeed(int seed);
 
+  /// Start the random number stream (e.g., the index of a toy).
+  void setStream(long stream);
+
+  /** Write the observed counts and the swarm to a binary file, which
+      can be read back by MultiPoissonGamma(filename). The file contains
+      the sections N, x, a, y, and b, where the last four are stored 
+      point by point.
+  */
+  void writeBinary(std::string filename);
+
   ///
   std::vector<double> counts() { return _N; }
 
   /// Sample size.
-  int size() { return _model.size(); }
+  int size() { return _npoints; }
   
  private:
     std::vector<double> _N;
     std::vector<double> _Ngen;
-    std::vector<MultiPoissonGammaModel> _model;
+
+    // parameters of the gamma priors; element (point k, bin i) is at
+    // index k*_nbins + i
+    std::vector<double> _x;
+    std::vector<double> _a;
+    std::vector<double> _y;
+    std::vector<double> _b;
     
-    TRandom3 _random;
+    CounterRNG _random;
     int  _nbins;
+    int  _npoints;
     int  _index;
     bool _profile;
 
+    // The swarm is read through these pointers, which point either to
+    // the vectors above or into a memory-mapped binary file. A mapped
+    // swarm is copied into the vectors before it is modified.
+    const double* _px;
+    const double* _pa;
+    const double* _py;
+    const double* _pb;
+    std::shared_ptr<SwarmFile> _file;
+
+    void _readBinary(std::string filename);
+    void _repoint();
+    void _unmap();
+
+    // Background coefficients for all points, computed once per 
+    // dataset, provided that they fit within a fixed budget. As in 
+    // MultiPoissonGammaModel, a cache is never modified once built.
+    struct BackgroundCache
+    {
+      std::vector<double> counts;    // counts for which cache was built
+      std::vector<double> rest;      // bound on sum of bins i,..., nbins-1
+      std::vector<int> offset;       // start of each bin's coefficients
+      int rowsize;                   // number of coefficients per point
+      std::vector<long double> C2;   // coefficients, point by point
+    };
+    std::shared_ptr<const BackgroundCache> _cache;
+    std::mutex _cachelock;
+
+    std::shared_ptr<const BackgroundCache> 
+    _background(std::vector<double>& N);
+
+    std::atomic<int> _argmax;        // point at last maximum
+
+    // log-likelihood of point k, or -inf if it is below bound
+    double _pointLogLikelihood(std::vector<double>& N, double mu, int k,
+			       const BackgroundCache& cache, double bound);
+
+    // log-likelihood of point k and its derivatives
+    double _pointDerivatives(std::vector<double>& N, double mu, int k,
+			     const BackgroundCache& cache, 
+			     double& d1, double& d2);
+
+    double _profileLogLikelihood(std::vector<double>& N, double mu,
+				 const BackgroundCache& cache, int& kbest);
+
     void _convert(std::vector<double>& sig, std::vector<double>& dsig,
 		  std::vector<double>& x,   std::vector<double>& a);
-    void _readTextFile(std::vector<std::string>& records);
+    void _readText(SwarmReader& reader, int npoints);
     void _readRootFile(std::vector<std::string>& records);
-    void _getcounts(std::string rfilename, std::string histname,
+    bool _getcounts(TFile& rfile, std::string histname,
 		    std::vector<double>& c, std::vector<double>& dc);    
 };
 
@@ -16,9 +16,10 @@
 //
 //--------------------------------------------------------------
 #include <vector>
-#include "Math/Random.h"
-#include "Math/GSLRndmEngines.h"
+#include <memory>
+#include <mutex>
 #include "PDFunction.h"
+#include "CounterRNG.h"
 
 /** Implement the Poisson-Gamma model marginalized 
     over the nuisance parameters.
@@ -93,6 +94,26 @@
       \f}
       where \f$k = (c / \delta c)^2\f$. And similarly for the effective
       luminosities.
+      <p>
+      Marginalizing over the priors makes the signal and background 
+      counts negative binomial variates, and the probability of the 
+      observed count \f$n\f$ in a bin is their convolution, whose cost
+      is \f$O(n)\f$. For bins with large counts, the probability 
+      is instead computed in \f$O(1)\f$ from the saddle-point 
+      approximation, including its second-order correction,
+      \f[
+      p(n) \approx \frac{\exp[K(\hat{t}) - \hat{t} n]}
+      {\sqrt{2\pi K''(\hat{t})}} 
+      \left(1 + \frac{\rho_4}{8} - \frac{5\rho_3^2}{24}\right),
+      \f]
+      where \f$K\f$ is the cumulant generating function of the sum,
+      \f$K'(\hat{t}) = n\f$, and \f$\rho_j = K^{(j)} / K''^{j/2}\f$.
+      The approximation is used for counts of at least 
+      setSaddlePointCount() (default 1000) provided that the correction
+      term is less than 10<sup>-3</sup> in magnitude, in which case the
+      relative error of the bin probability is less than about 
+      10<sup>-6</sup>. Otherwise, e.g., when \f$x\f$ or \f$y\f$ is small 
+      and the distribution very skewed, the sum is computed exactly.
 */
 class MultiPoissonGammaModel : public PDFunction
 {
@@ -108,8 +129,7 @@ class MultiPoissonGammaModel : public PDFunction
       @param a - scale factors for effective luminosity prior
       @param y - counts for background prior
       @param b - scale factors for background prior
-      @maxcount - maximum allowed value of observed count 
-      (this sets the sizes of some internal arrays).
+      @maxcount - maximum allowed value of observed count.
   */
   MultiPoissonGammaModel(std::vector<double>& data,
 			 std::vector<double>& x, 
@@ -124,8 +144,7 @@ class MultiPoissonGammaModel : public PDFunction
       @param a - scale factor for effective luminosity prior
       @param y - counts for background prior
       @param b - scale factor for background prior
-      @maxcount - maximum allowed value of observed count 
-      (this sets the sizes of some internal arrays).
+      @maxcount - maximum allowed value of observed count.
   */
   MultiPoissonGammaModel(std::vector<double>& data,
 			 std::vector<double>& x,
@@ -140,8 +159,7 @@ class MultiPoissonGammaModel : public PDFunction
       @param a - scale factor for effective luminosity prior
       @param y - count for background prior
       @param b - scale factor for background prior
-      @maxcount - maximum allowed value of observed count 
-      (this sets the sizes of some internal arrays).
+      @maxcount - maximum allowed value of observed count.
   */
   MultiPoissonGammaModel(double data,
 			 double x,
@@ -150,6 +168,12 @@ class MultiPoissonGammaModel : public PDFunction
 			 double b,  
 			 int maxcount=100000); 
  
+  ///
+  MultiPoissonGammaModel(const MultiPoissonGammaModel& other);
+
+  ///
+  MultiPoissonGammaModel& operator=(const MultiPoissonGammaModel& other);
+
   ///
   ~MultiPoissonGammaModel();
   
@@ -165,12 +189,37 @@ class MultiPoissonGammaModel : public PDFunction
   {
     _y = y;
     _b = b;
+    std::lock_guard<std::mutex> lock(_cachelock);
+    _cache.reset();
   }    
   
+  /** Set the smallest observed count for which the likelihood of a 
+      bin is computed using the saddle-point approximation. Use a 
+      count greater than maxcount to always compute the exact sum.
+  */
+  void setSaddlePointCount(int count) { _saddlecount = count; }
+
   /** Generate data for one experiment.
         @param sigma - value of parameter of interest
   */
   std::vector<double>& generate(double sigma);
+
+  /** Generate ntoys experiments from streams firststream,...,
+      firststream + ntoys-1, the efficiencies, backgrounds and counts
+      of all the toys being sampled together, bin by bin.
+        @param sigma       - value of parameter of interest
+        @param ntoys       - number of experiments
+        @param data        - counts, ntoys x nbins
+        @param firststream - stream of the first experiment
+  */
+  void generateBatch(double sigma, int ntoys, std::vector<double>& data,
+		     long firststream=0);
+
+  /** Return the Asimov dataset, the mean count of each bin. The
+      counts are not rounded (see logProbability).
+        @param sigma - value of parameter of interest
+  */
+  std::vector<double> asimov(double sigma);
   
   /** Compute likelihood.
       @param data  - observed counts
@@ -182,8 +231,82 @@ class MultiPoissonGammaModel : public PDFunction
       @param sigma - parameter of interest 
   */
   double operator() (double sigma);
+
+  /** Compute log-likelihood, summing the log of each bin's marginal
+      probability rather than multiplying the probabilities.
+      @param data  - observed counts
+      @param sigma - parameter of interest 
+  */
+  double logLikelihood(std::vector<double>& data, double sigma);
+
+  /** Compute log-likelihood using cached data.
+      @param sigma - parameter of interest 
+  */
+  double logLikelihood(double sigma);
+
+  /** Compute log-likelihood and its first and second derivatives
+      with respect to sigma.
+      @param data  - observed counts
+      @param sigma - parameter of interest 
+      @param lnL   - log-likelihood
+      @param d1    - first derivative
+      @param d2    - second derivative
+  */
+  bool derivatives(std::vector<double>& data, double sigma,
+		   double& lnL, double& d1, double& d2);
+
+  /// The likelihood may be computed from several threads at once.
+  bool reentrant() { return true; }
+
+  /// Return a copy of this model.
+  PDFunction* clone() { return new MultiPoissonGammaModel(*this); }
+
+  /// Seed the random number generator.
+  void setSeed(int seed);
+
+  /// Start the random number stream (e.g., the index of a toy).
+  void setStream(long stream);
     
   std::vector<double>& counts() { return _data; }
+
+  /** Compute the log of the marginal probability of count n in a bin.
+      This is the kernel of the likelihood, which is shared with
+      MultiPoissonGamma. The probability is defined for integer 
+      counts; for other counts, such as those of an Asimov dataset, 
+      the log-probability is interpolated linearly between the 
+      neighboring integers. For a Poisson probability this is exact
+      in its dependence on the mean.
+      @param n     - observed count
+      @param sigma - parameter of interest 
+      @param x, a, y, b - parameters of the gamma priors
+      @param C2    - background coefficients for count ceil(n); if 
+                     zero, they are computed here
+      @param saddlecount - see setSaddlePointCount()
+  */
+  static double logProbability(double n, double sigma,
+			       double x, double a,
+			       double y, double b,
+			       const long double* C2=0,
+			       int saddlecount=1000);
+
+  /** Compute the log of the marginal probability of count n in a bin
+      and its first and second derivatives, d1 and d2, with respect
+      to sigma. The derivatives are exact, except when the 
+      saddle-point approximation is used, in which case they are
+      computed by finite differences.
+  */
+  static double logProbability(double n, double sigma,
+			       double x, double a,
+			       double y, double b,
+			       double& d1, double& d2,
+			       const long double* C2=0,
+			       int saddlecount=1000);
+
+  /** Compute the background coefficients C2[k], k = 0,..., n, which
+      depend on the count n but not on the parameter of interest.
+  */
+  static void backgroundCoefficients(int n, double y, double b,
+				     long double* C2);
   
  private:
   std::vector<double> _data;
@@ -192,7 +315,37 @@ class MultiPoissonGammaModel : public PDFunction
   std::vector<double> _y;
   std::vector<double> _b;
   int _maxcount;
-  ROOT::Math::Random<ROOT::Math::GSLRngMT>* _gslRan;
+  int _saddlecount;
+  CounterRNG _random;
+
+  // The background coefficients depend only on the observed counts
+  // and on (y, b), so they are computed once per dataset. A cache is
+  // never modified once built; a new one replaces it when the data 
+  // change, so threads evaluating the likelihood can share it.
+  struct BackgroundCache
+  {
+    std::vector<double> counts;      // counts for which cache was built
+    std::vector<int> offset;         // start of each bin's coefficients
+    std::vector<long double> C2;     // coefficients, bin by bin
+  };
+  std::shared_ptr<const BackgroundCache> _cache;
+  std::mutex _cachelock;
+
+  std::shared_ptr<const BackgroundCache> 
+  _background(std::vector<double>& data);
+
+  // logProbability for integer counts
+  static double _logProbability(int n, double sigma,
+				double x, double a,
+				double y, double b,
+				const long double* C2,
+				int saddlecount);
+  static double _logProbability(int n, double sigma,
+				double x, double a,
+				double y, double b,
+				double& d1, double& d2,
+				const long double* C2,
+				int saddlecount);
 };
 
 #endif
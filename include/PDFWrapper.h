@@ -55,6 +55,24 @@ class PDFWrapper : public PDFunction
       @param poi  - parameter of interest 
   */
   double operator() (std::vector<double>& data_, double poi);
+
+  /** Computes log of PDF.
+      @param data - observed data (could be binned)
+      @param poi  - parameter of interest 
+  */
+  double logLikelihood(std::vector<double>& data_, double poi);
+
+  /** Computes PDF at several values of the parameter of interest,
+      setting the observables only once.
+      @param data   - observed data (could be binned)
+      @param poi    - values of parameter of interest 
+      @param result - PDF values
+      @param uselog - if true, return log of PDF
+  */
+  void evaluate(std::vector<double>& data_, 
+		std::vector<double>& poi,
+		std::vector<double>& result, 
+		bool uselog=false);
   virtual double getVal() {return _pdf->getVal(); }
   virtual RooRealVar* getPoi() {return _poi;}
   virtual std::string GetTitle() {return _pdf->GetTitle(); }
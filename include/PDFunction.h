@@ -56,6 +56,94 @@ class PDFunction
   */
   virtual double operator() (std::vector<double>& data, double theta)=0; 
 
+  /** Return the Asimov dataset, that is, the expected data for the
+      given value of the parameter of interest. The default returns
+      an empty vector, meaning that the model does not provide it.
+  */
+  virtual std::vector<double> asimov(double /*theta*/) 
+  { return std::vector<double>(); }
+
+  /** Compute the natural logarithm of the likelihood. 
+      The default implementation takes the log of operator(). Derived 
+      classes with many bins should override this method and work in
+      log space throughout, since the product of many small 
+      probabilities can underflow.
+  */
+  virtual double logLikelihood(std::vector<double>& data, double theta);
+
+  /** Compute the likelihood of one dataset at several values of the 
+      parameter of interest. The default implementation calls 
+      logLikelihood once per value. Derived classes should override
+      it when the likelihood can be computed for all values in a
+      single pass over the model.
+      @param data   - observed data
+      @param theta  - values of the parameter of interest
+      @param result - likelihood for each value of theta
+      @param uselog - if true, return log-likelihoods
+  */
+  virtual void evaluate(std::vector<double>& data, 
+			std::vector<double>& theta,
+			std::vector<double>& result, 
+			bool uselog=false);
+
+  /** Compute the log-likelihood and its first and second derivatives
+      with respect to the parameter of interest. The default returns
+      false, meaning that the model does not provide them, in which
+      case fits fall back on methods that need only the likelihood.
+      @param data  - observed data
+      @param theta - parameter of interest
+      @param lnL   - log-likelihood
+      @param d1    - first derivative of lnL
+      @param d2    - second derivative of lnL
+      @return true if lnL, d1 and d2 were computed
+  */
+  virtual bool derivatives(std::vector<double>& /*data*/, 
+			   double /*theta*/,
+			   double& /*lnL*/, double& /*d1*/, double& /*d2*/)
+  { return false; }
+
+  /** Return true if the likelihood may be computed from several 
+      threads at once, that is, if operator(), logLikelihood and 
+      evaluate do not modify the state of the object. 
+  */
+  virtual bool reentrant() { return false; }
+
+  /** Return a copy of this object, allocated with new, that can be
+      used independently of the original, for example in another 
+      thread. The default returns 0, meaning that the model cannot 
+      be copied.
+  */
+  virtual PDFunction* clone() { return 0; }
+
+  /** Seed the random number generator(s) used by generate.
+      The default does nothing.
+  */
+  virtual void setSeed(int /*seed*/) {}
+
+  /** Start stream number stream of the random number generator(s)
+      used by generate. For a given seed, each stream is independent
+      and reproducible, so that, e.g., a toy dataset can be regenerated
+      from the seed and the index of the toy alone. The default does 
+      nothing.
+  */
+  virtual void setStream(long /*stream*/) {}
+
+  /** Generate ntoys datasets at once. Dataset t is the one generate
+      returns after setStream(firststream + t), and is stored in
+      data[t*nbins],..., data[t*nbins + nbins-1]. On return, the 
+      random number generator(s) are at the end of the last stream, as
+      after the equivalent calls to generate. The default calls 
+      generate once per dataset; derived classes should override it 
+      when the datasets can be generated together more efficiently.
+      @param theta       - parameter of interest
+      @param ntoys       - number of datasets
+      @param data        - datasets, one after the other
+      @param firststream - stream of the first dataset
+  */
+  virtual void generateBatch(double theta, int ntoys, 
+			     std::vector<double>& data,
+			     long firststream=0);
+
  private:
   ClassDef(PDFunction,1)
 };
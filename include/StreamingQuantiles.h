@@ -0,0 +1,71 @@
+#ifndef STREAMINGQUANTILES_H
+#define STREAMINGQUANTILES_H
+//--------------------------------------------------------------
+// File: StreamingQuantiles.h
+// Description: Estimate quantiles of a stream of values, and their
+//              Monte Carlo uncertainties, in bounded memory.
+//--------------------------------------------------------------
+#include <vector>
+
+/** Estimate several quantiles of a stream of values.
+    <p>
+    The first values, up to exactsize of them, are kept and the
+    quantiles are computed from them exactly. Thereafter, the values
+    are discarded and the quantiles are tracked with the extended P^2
+    algorithm (R. Jain and I. Chlamtac, Comm. ACM 28 (1985) 1076;
+    K. Raatikainen, Comm. ACM 30 (1987) 840), which updates a marker
+    at each requested probability, at the midpoints between them, and
+    at the extremes.
+    <p>
+    The Monte Carlo uncertainty of the quantile \f$q_p\f$ from \f$n\f$
+    values is estimated as
+    \f$\sqrt{p (1 - p) / n} \, dq/dp\f$, where the derivative is
+    approximated by the difference of the quantiles at the neighboring
+    midpoints.
+ */
+class StreamingQuantiles
+{
+public:
+  /// Default number of values kept.
+  enum { EXACTSIZE=1 << 12 };
+
+  /**
+     @param prob      - probabilities of the quantiles, in (0, 1)
+     @param exactsize - number of values kept before switching to P^2
+  */
+  StreamingQuantiles(const std::vector<double>& prob,
+		     int exactsize=EXACTSIZE);
+
+  ///
+  ~StreamingQuantiles() {}
+
+  /// Add a value.
+  void add(double x);
+
+  /// Return the quantiles, in the order of the probabilities.
+  std::vector<double> quantiles() const;
+
+  /// Return the estimated Monte Carlo uncertainties of the quantiles.
+  std::vector<double> errors() const;
+
+  /// Return the number of values added.
+  int count() const { return _count; }
+
+  /// Return true if the quantiles are exact.
+  bool exact() const { return _count <= _exactsize; }
+
+private:
+  std::vector<double> _prob;
+  int _exactsize;
+  int _count;
+  std::vector<int> _index;     // marker of each requested probability
+  std::vector<double> _p;      // probabilities of the markers
+  std::vector<double> _q;      // heights of the markers
+  std::vector<double> _n;      // positions of the markers
+  std::vector<double> _values; // values kept while exact
+
+  void _start();
+  std::vector<double> _markers() const;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef SWARMFILE_H
+#define SWARMFILE_H
+//--------------------------------------------------------------
+// File: SwarmFile.h
+// Description: Read and write swarms of sampled points in a 
+//              binary format that can be memory-mapped, so that
+//              models can use the arrays in place without 
+//              parsing or copying them.
+//--------------------------------------------------------------
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/** A swarm file stored in binary.
+    <p>
+    The file starts with a 512-byte header containing a magic string,
+    the format version, the type of model that wrote the file, the size
+    of each value in bytes (only 8, i.e., double, is supported), the 
+    number of bins, the number of points, and a table giving the 
+    offset and length of each array (section) in the payload. Each
+    section is aligned on a 64-byte boundary. The meaning and order of 
+    the sections is defined by the model; see 
+    MultiPoisson::writeBinary() and MultiPoissonGamma::writeBinary().
+    <p>
+    A SwarmFile maps the file read-only. The mapping is released when
+    the object is destroyed, so models that use the arrays in place
+    hold a shared pointer to it.
+ */
+class SwarmFile
+{
+public:
+  /// Model types.
+  enum { MULTIPOISSON=1, MULTIPOISSONGAMMA=2 };
+
+  /// Current format version.
+  enum { VERSION=1 };
+  
+  /// Return true if the file starts with the swarm file magic string.
+  static bool isBinary(std::string filename);
+
+  /** Map a swarm file. Exit with an error if the file cannot be
+      mapped, or was written by a different model, version, or for
+      a different value type.
+  */
+  SwarmFile(std::string filename, int model);
+
+  ///
+  ~SwarmFile();
+
+  ///
+  int nbins() const { return _nbins; }
+
+  ///
+  int npoints() const { return _npoints; }
+
+  /// Return the model-defined stride (e.g., padded number of points).
+  int stride() const { return _stride; }
+
+  /// Return number of sections.
+  int size() const { return (int)_sections.size(); }
+  
+  /// Return pointer to start of section i.
+  const double* section(int i) const { return _sections[i].first; }
+
+  /// Return number of values in section i.
+  size_t length(int i) const { return _sections[i].second; }
+
+  /** Exit with an error unless the file has exactly the sections
+      expected by the model, with the given numbers of values. Models
+      must call this before using the sections.
+  */
+  void checkSections(const std::vector<size_t>& lengths) const;
+  
+  /** Write a swarm file.
+      @param filename - output file
+      @param model    - model type
+      @param nbins    - number of bins
+      @param npoints  - number of points
+      @param stride   - model-defined stride
+      @param sections - (pointer, length) of each array to be written
+  */
+  static void write(std::string filename, int model, 
+		    int nbins, int npoints, int stride,
+		    std::vector<std::pair<const double*, size_t> >& 
+		    sections);
+  
+private:
+  std::string _filename;
+  void*  _address;
+  size_t _size;
+  int    _nbins;
+  int    _npoints;
+  int    _stride;
+  std::vector<std::pair<const double*, size_t> > _sections;
+
+  // not copyable
+  SwarmFile(const SwarmFile&);
+  SwarmFile& operator=(const SwarmFile&);
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef SWARMREADER_H
+#define SWARMREADER_H
+//--------------------------------------------------------------
+// File: SwarmReader.h
+// Description: Read a swarm of sampled points from a text file
+//              a chunk at a time, so that the file need not be
+//              held in memory while it is decoded.
+//              The records of a chunk are decoded in parallel.
+//--------------------------------------------------------------
+#include <string>
+#include <vector>
+#include <fstream>
+
+/** Read the records of a text swarm file sequentially.
+    <p>
+    A record is a line that is neither blank nor a comment (a line
+    starting with #). The models read the header records with next()
+    and decode the sampled points with read(), a chunk of at most
+    CHUNKSIZE values at a time, so that the memory needed beyond the
+    model itself is bounded by the size of a chunk.
+    <p>
+    The file is read in blocks, which are split into records in place.
+    The numbers are decoded with std::from_chars, which, unlike stream
+    extraction or strtod, does not consult the locale, and the records
+    of a block are decoded in parallel using the ThreadPool.
+    <p>
+    Since the reader is left positioned after the last point read,
+    a model can be built from the first points of a file and extended
+    later, e.g.,
+    \code
+    SwarmReader reader("swarm.dat");
+    MultiPoisson model(reader, 1000);   // header and first 1000 points
+       :  use model
+    model.read(reader, 1000);           // next 1000 points
+    \endcode
+*/
+class SwarmReader
+{
+public:
+  /// Number of values decoded at a time by the models.
+  enum { CHUNKSIZE=1 << 20 };
+
+  /// Open a text file. Exit with an error if it cannot be opened.
+  SwarmReader(std::string filename);
+
+  ///
+  ~SwarmReader();
+
+  /** Get the next record, with leading and trailing white space
+      removed. Return false at the end of the file.
+  */
+  bool next(std::string& record);
+
+  /** Decode the next nrecords records, each of which must contain at
+      least ncolumns numbers, into values, record by record. Return the
+      number of records decoded, which is less than nrecords only at
+      the end of the file. Exit with an error if a record cannot be
+      decoded.
+  */
+  int read(int nrecords, int ncolumns, std::vector<double>& values);
+
+  /** Decode the first ncolumns numbers of a record into values.
+      Return the number of values decoded.
+  */
+  static int decode(const std::string& record, int ncolumns,
+		    double* values);
+
+  /// Decode the first ncolumns numbers in [begin, end).
+  static int decode(const char* begin, const char* end, int ncolumns,
+		    double* values);
+
+  /// Return the name of the file.
+  std::string filename() const { return _filename; }
+
+  /// Return the number of the line last read.
+  int lineno() const { return _lineno; }
+
+private:
+  std::string   _filename;
+  std::ifstream _stream;
+  int           _lineno;
+  std::vector<char> _buffer;
+  size_t        _begin;   // start of unread text in buffer
+  size_t        _end;     // end of text in buffer
+  bool          _eof;
+
+  bool _record(const char*& begin, const char*& end);
+  bool _refill();
+
+  // not copyable
+  SwarmReader(const SwarmReader&);
+  SwarmReader& operator=(const SwarmReader&);
+};
+
+#endif
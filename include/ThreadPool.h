@@ -0,0 +1,62 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+//--------------------------------------------------------------
+// File: ThreadPool.h
+// Description: A fixed-size pool of worker threads shared by the
+//              limit calculators. The number of threads is taken
+//              from the environment variable limits_nthreads
+//              (default: the number of cores). Set
+//              limits_nthreads=1 to run everything serially.
+//--------------------------------------------------------------
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/** A fixed-size pool of worker threads.
+    <p>
+    run(ntasks, task) calls task(i) for i = 0,..., ntasks-1 and returns 
+    once all calls are done. The calling thread works through the queue
+    while it waits. A task that itself calls run() executes its
+    sub-tasks inline, so nested parallel loops cannot deadlock. If a
+    task throws, run() still waits for the other tasks and then
+    rethrows the first exception.
+    <p>
+    A pool of more than one thread enables ROOT's thread safety when
+    it is created, so that tasks may use ROOT objects (each its own).
+ */
+class ThreadPool
+{
+public:
+  /// Return the pool shared by all calculators.
+  static ThreadPool& instance();
+
+  /// Number of threads requested through limits_nthreads.
+  static int defaultSize();
+
+  ///
+  explicit ThreadPool(int nthreads);
+
+  ///
+  ~ThreadPool();
+
+  /// Number of threads, including the calling thread.
+  int size() const { return _workers.size() + 1; }
+
+  /// Call task(i), i = 0,..., ntasks-1, and wait for all to finish.
+  void run(int ntasks, const std::function<void(int)>& task);
+
+private:
+  std::vector<std::thread> _workers;
+  std::deque<std::function<void()> > _queue;
+  std::mutex _mutex;
+  std::condition_variable _ready;
+  bool _stop;
+
+  void _work();
+  bool _next(std::function<void()>& job);
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef VECTORMATH_H
+#define VECTORMATH_H
+//--------------------------------------------------------------
+// File: VectorMath.h
+// Description: Elementary functions of vectors of doubles, written
+//              with the GCC/clang vector extensions, for the SIMD
+//              kernels of the models and random number generator.
+//--------------------------------------------------------------
+
+// Kernels marked SIMD_CLONES are compiled for AVX-512, AVX2 and
+// baseline SSE2 on x86-64 Linux, and the best version is selected when
+// the library is loaded. The versions give identical results only if
+// multiplies and adds are not fused, so the files that contain such
+// kernels are compiled with -ffp-contract=off (see the Makefile).
+// Define NO_SIMD_CLONES to compile the baseline version only, e.g., 
+// to check that it gives the same toys.
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__) && \
+  !defined(NO_SIMD_CLONES)
+#define SIMD_CLONES __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define SIMD_CLONES
+#endif
+
+#if defined(__GNUC__)
+namespace VectorMath
+{
+  typedef double    vdouble __attribute__((vector_size(64)));
+  typedef long long vint    __attribute__((vector_size(64)));
+  const int VSIZE = sizeof(vdouble) / sizeof(double);
+
+  // Adding 2^52 + 2^51 to x, |x| < 2^51, rounds x to an integer n,
+  // and leaves n in the low bits of the sum.
+  const double    MAGIC     = 6755399441055744.0;
+  const long long MAGICBITS = 0x4338000000000000LL;
+
+  /// Replace x by floor(x), for |x| < 2^51.
+  inline __attribute__((always_inline))
+  void vfloor(vdouble& x)
+  {
+    vdouble r = (x + MAGIC) - MAGIC;
+    x = r > x ? r - 1.0 : r;
+  }
+
+  /// Replace x by log(x) (-inf if x <= 0). This is the Cephes
+  /// algorithm, written without branches; it is accurate to 2 ulp.
+  inline __attribute__((always_inline))
+  void vlog(vdouble& x)
+  {
+    // split x into exponent e and mantissa m in [sqrt(1/2), sqrt(2))
+    vint u     = (vint)x;
+    vint mant  = u & 0x000fffffffffffffLL;
+    vint small = mant < 0x0006a09e667f3bcdLL;
+    vint ue    = ((u >> 52) & 0x7ff) | 0x4330000000000000LL;
+    vint um    = mant | (0x3fe0000000000000LL +
+			 (small & 0x0010000000000000LL));
+    vdouble e  = (vdouble)ue - (4503599627370496.0 + 1022);
+    e -= (vdouble)(small & 0x3ff0000000000000LL);
+    vdouble m  = (vdouble)um - 1.0;
+
+    // log(1 + m) = m - m^2/2 + m^3 P(m)/Q(m)
+    vdouble z  = m * m;
+    vdouble p  = ((((1.01875663804580931796E-4*m
+		     + 4.97494994976747001425E-1)*m
+		    + 4.70579119878881725854E0)*m
+		   + 1.44989225341610930846E1)*m
+		  + 1.79368678507819816313E1)*m + 7.70838733755885391666E0;
+    vdouble q  = ((((m + 1.12873587189167450590E1)*m
+		    + 4.52279145837532221105E1)*m
+		   + 8.29875266912776603211E1)*m
+		  + 7.11544750618563894466E1)*m + 2.31251620126765340583E1;
+    vdouble y  = m * (z * p / q);
+    y = y - e * 2.121944400546905827679e-4;
+    y = y - 0.5 * z;
+    vdouble r  = m + y + e * 0.693359375;
+
+    vint positive = u > 0;
+    x = (vdouble)(((vint)r & positive) |
+		  (0xfff0000000000000LL & ~positive));
+  }
+
+  /// Replace x by exp(x), for x in [-708, 709] (x is clamped to that
+  /// range). This is the Cephes algorithm; it is accurate to 1 ulp.
+  inline __attribute__((always_inline))
+  void vexp(vdouble& x)
+  {
+    vdouble zero = {};
+    x = x < -708.0 ? zero - 708.0 : x;
+    x = x >  709.0 ? zero + 709.0 : x;
+
+    // exp(x) = 2^n exp(r), |r| <= log(2)/2
+    vdouble n  = (1.4426950408889634073599 * x + MAGIC) - MAGIC;
+    vdouble r  = x - n * 6.93145751953125E-1;
+    r = r - n * 1.42860682030941723212E-6;
+
+    // exp(r) = 1 + 2 r P(r^2) / (Q(r^2) - r P(r^2))
+    vdouble z  = r * r;
+    vdouble p  = r * ((1.26177193074810590878E-4*z
+		       + 3.02994407707441961300E-2)*z
+		      + 9.99999999999999999910E-1);
+    vdouble q  = ((3.00198505138664455042E-6*z
+		   + 2.52448340349684104192E-3)*z
+		  + 2.27265548208155028766E-1)*z + 2.00000000000000000009E0;
+    vdouble e  = 1.0 + 2.0 * (p / (q - p));
+
+    // 2^n, built from its exponent bits
+    vint bits  = ((vint)(n + MAGIC) - MAGICBITS + 1023) << 52;
+    x = e * (vdouble)bits;
+  }
+
+  /// Compute s = sin(2 pi u) and c = cos(2 pi u), for u in [0, 1].
+  /// The Cephes polynomials are used on [-pi/4, pi/4].
+  inline __attribute__((always_inline))
+  void vsincos2pi(const vdouble& u, vdouble& s, vdouble& c)
+  {
+    // 2 pi u = q pi/2 + a, |a| <= pi/4
+    vdouble y  = 4.0 * u;
+    vdouble q  = (y + MAGIC) - MAGIC;
+    vdouble a  = (y - q) * 1.57079632679489661923;
+    vdouble z  = a * a;
+    vdouble sa = a + a * z *
+      (((((1.58962301576546568060E-10*z
+	   - 2.50507477628578072866E-8)*z
+	  + 2.75573136213857245213E-6)*z
+	 - 1.98412698295895385996E-4)*z
+	+ 8.33333333332211858878E-3)*z - 1.66666666666666307295E-1);
+    vdouble ca = 1.0 - 0.5 * z + z * z *
+      (((((-1.13585365213876817300E-11*z
+	   + 2.08757008419747316778E-9)*z
+	  - 2.75573141792967388112E-7)*z
+	 + 2.48015872888517045348E-5)*z
+	- 1.38888888888730564116E-3)*z + 4.16666666666665929218E-2);
+
+    // rotate by the quadrant q
+    vint iq   = (vint)(q + MAGIC) & 3;
+    vint swap = (iq & 1) != 0;
+    vdouble ss = swap ? ca : sa;
+    vdouble cc = swap ? sa : ca;
+    s = (iq & 2) != 0 ? -ss : ss;
+    c = ((iq + 1) & 2) != 0 ? -cc : cc;
+  }
+};
+#endif
+
+#endif
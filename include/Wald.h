@@ -20,6 +20,7 @@
 // ---------------------------------------------------------------------------
 #include <vector>
 #include "PDFunction.h"
+#include "CachedPDF.h"
 #include "LimitCalculator.h"
 // ---------------------------------------------------------------------------
 /** Compute limits based on Wald approximation.
@@ -51,7 +52,7 @@ class Wald : public LimitCalculator
 {
  public:
   ///
-  Wald () {}
+  Wald () : _model(0), _poihat(0), _poierr(0), _ownpdf(false) {}
 
   /** Compute limits based on Wald approximation.
       @param model  - probability density function (pdf)
@@ -68,8 +69,16 @@ class Wald : public LimitCalculator
   
   virtual ~Wald();
 
+  /** Return a copy of this calculator with its own copy of the model,
+      or 0 if the model cannot be copied.
+   */
+  LimitCalculator* clone();
+
   PDFunction* pdf() {return _model;}
 
+  /// Return the cache through which the likelihood is computed.
+  CachedPDF* cache() {return &_cache;}
+
  /** Compute Z-value given parameter of interest using Z = sqrt[2*ln L(poi_hat)/L(0)].
    */
   double zvalue(double poi);
@@ -99,12 +108,20 @@ class Wald : public LimitCalculator
   ///
   void setData(std::vector<double>& d);
 
+  /// Discard the cached likelihoods (see CachedPDF) and fit again.
+  void clearCache();
+
+  /// Start the next fit from the middle of the range rather than
+  /// from the current estimate.
+  void reset() { _poierr = 0; }
+
   // For internal use.
   double fit(double guess=-1);
   double nll(double poi);
 
  private:
   PDFunction* _model; 
+  CachedPDF   _cache;
   std::vector<double> _data;
 
   double   _poimin;
@@ -113,6 +130,7 @@ class Wald : public LimitCalculator
   double   _poihat;
   double   _poierr;
   int      _verbosity;
+  bool     _ownpdf;
 
   double   _f(double poi);
   
@@ -38,7 +38,7 @@
 #include <vector>
 #include <cmath>
 #include <cstdlib> 
-#include "TRandom3.h"
+#include "CounterRNG.h"
 #include "TMatrixDSym.h"
 #include "TMinuit.h"
 
@@ -58,6 +58,9 @@ public:
   ///
   void setSeed(int seed);
 
+  /// Start the random number stream.
+  void setStream(long stream);
+
   /// Add one row of covariance matrix.
   void addRow(std::vector<double>& row);
 
@@ -79,7 +82,7 @@ public:
   void printme();
 
 private:
-  TRandom3 random;
+  CounterRNG random;
   int n;
   std::vector<double> a;
   std::vector<double> z;
@@ -17,30 +17,26 @@
 #include <stdlib.h>
 
 #include "Bayes.h"
-#include "TMinuit.h"
+#include "ThreadPool.h"
+#include "BrentMinimizer.h"
 #include "TMath.h"
-#include "Math/WrappedFunction.h"
-#include "Math/Integrator.h"
-#include "Math/RootFinder.h"
 
 using namespace std;
-// ---------------------------------------------------------------------------
 
-// function to be minimized
 namespace {
-  const int MAXITER=10000;
-  const double TOLERANCE=1.e-5;
-  Bayes* OBJ=0;
-  void nlpFunc(int&    /*npar*/, 
-	       double* /*grad*/, 
-	       double& fval,
-	       double* xval,
-	       int     /*iflag*/)
+  // largest number of times a panel is halved
+  const int MAXPASSES=30;
+
+  // a panel of the adaptive integration of the posterior density
+  struct Panel
   {
-    double poi = xval[0];
-    fval = -log(OBJ->posterior(poi));
-  }
+    double a, b;            // ends 
+    double fa, fm, fb;      // density at ends and midpoint
+    double left, right;     // integrals over the halves
+    bool operator<(const Panel& o) const { return a < o.a; }
+  };
 };
+// ---------------------------------------------------------------------------
 
 Bayes::Bayes(PDFunction& model,
 	     std::vector<double>& d,
@@ -49,9 +45,12 @@ Bayes::Bayes(PDFunction& model,
 	     double cl_,
 	     PriorFunction* prior_)
   : _pdf(&model),
+    _cache(model),
     _data(d),
     _poimin(poimin),
     _poimax(poimax),
+    _poilower(poimin),
+    _poiupper(poimax),
     _cl(cl_),
     _prior(prior_),
 #ifdef __WITH_ROOFIT__
@@ -59,20 +58,26 @@ Bayes::Bayes(PDFunction& model,
     _rfpoi(0),
 #endif
     _normalize(true),
-    _interp(0),
-    _nsteps(50),
+    _ownpdf(false),
+    _nsteps(20),
     _x(vector<double>()),
     _y(vector<double>()),
+    _f(vector<double>()),
+    _tolerance(1.e-4),
+    _maxevaluations(MAXEVALUATIONS),
+    _error(0),
+    _nevaluations(0),
+    _perror(0),
     _MAPdone(false),
     _result(std::pair<double, double>(0, 0)),
-    _verbosity(-1)
+    _verbosity(-1),
+    _warmstart(true),
+    _tabulated(false)
 {
   if ( getenv("limits_verbosity") != (char*)0 )
     _verbosity = atoi(getenv("limits_verbosity"));
 
   assert( _poimax > _poimin ); 
-  OBJ = this;
-  normalize();
 }
 
 #ifdef __WITH_ROOFIT__
@@ -80,27 +85,36 @@ Bayes::Bayes(RooAbsPdf& pdf, RooArgSet& obs, RooRealVar& poi,
 	     double cl_,
 	     RooAbsPdf* prior_)
   : _pdf(new PDFWrapper(pdf, obs, poi)),
+    _cache(*_pdf),
     _data(vector<double>(obs.getSize())),
     _poimin(poi.getMin()),
     _poimax(poi.getMax()),
+    _poilower(poi.getMin()),
+    _poiupper(poi.getMax()),
     _cl(cl_),
     _prior(0),
     _rfprior(prior_),
     _rfpoi(&poi),
     _normalize(true),
-    _interp(0),
-    _nsteps(50),
+    _ownpdf(true),
+    _nsteps(20),
     _x(vector<double>()),
     _y(vector<double>()),
+    _f(vector<double>()),
+    _tolerance(1.e-4),
+    _maxevaluations(MAXEVALUATIONS),
+    _error(0),
+    _nevaluations(0),
+    _perror(0),
     _MAPdone(false),
     _result(std::pair<double, double>(0, 0)),
-    _verbosity(-1)
+    _verbosity(-1),
+    _warmstart(true),
+    _tabulated(false)
 {
   if ( getenv("limits_verbosity") != (char*)0 )
     _verbosity = atoi(getenv("limits_verbosity"));
   
-  OBJ = this;
-  normalize();
   RooArgList list(obs);
   for(size_t c=0; c < _data.size(); c++)
     {
@@ -113,12 +127,33 @@ Bayes::Bayes(RooAbsPdf& pdf, RooArgSet& obs, RooRealVar& poi,
 
 Bayes::~Bayes() 
 {
-  // if _rfpoi is non-zero, this means we are using the RooFit
-  // interface
-  #ifdef __WITH_ROOFIT__
-  if (_rfpoi) delete _pdf;
-  #endif
-  if (_interp) delete _interp;
+  // we own the model if we were created through the RooFit 
+  // interface or by clone()
+  if (_ownpdf) delete _pdf;
+}
+
+LimitCalculator*
+Bayes::clone()
+{
+  if ( _prior ) return 0;
+#ifdef __WITH_ROOFIT__
+  if ( _rfprior ) return 0;
+#endif
+  PDFunction* model = _pdf->clone();
+  if ( model == 0 ) return 0;
+  
+  // the copy has the same bounds and starts from the current support,
+  // so it can be warm started if this calculator has tabulated the 
+  // posterior
+  Bayes* bayes = new Bayes(*model, _data, _poilower, _poiupper, _cl);
+  bayes->_poimin = _poimin;
+  bayes->_poimax = _poimax;
+  bayes->_ownpdf = true;
+  bayes->_warmstart = _warmstart;
+  bayes->_tolerance = _tolerance;
+  bayes->_maxevaluations = _maxevaluations;
+  bayes->_tabulated = _tabulated;
+  return bayes;
 }
 
 double 
@@ -141,7 +176,13 @@ Bayes::prior(double poi)
 double 
 Bayes::likelihood(double poi)
 {
-  return (*_pdf)(_data, poi);
+  return _cache(_data, poi);
+}
+
+double 
+Bayes::logLikelihood(double poi)
+{
+  return _cache.logLikelihood(_data, poi);
 }
 
 double 
@@ -151,29 +192,80 @@ Bayes::normalize()
 
   int   nsteps = 2 * _nsteps;
   vector<double> p(nsteps+1);
+  vector<double> poi(nsteps+1);
   double step  = 0;
-  
-  for(int ii=0; ii < 2; ii++)
+  double factor = 1.e-5;
+  _nevaluations = 0;
+
+  // work with ln(likelihood x prior) and scale the density by its 
+  // maximum before exponentiating so that it cannot underflow
+  double lnpmax = 0.0;
+
+  // when warm starting, first try the support found for the previous
+  // data. It is kept if the density is negligible at its edges (unless
+  // the left edge is at zero) and the bulk of the density spans at 
+  // least a third of it, so that it is resolved by the grid. Then 
+  // the density need be computed only once.
+  bool warm = false;
+  if ( _warmstart && _tabulated )
+    {
+      step = (_poimax - _poimin) / nsteps;
+      for(int i=0; i < nsteps+1; i++) poi[i] = _poimin + i*step;
+      _loglikeprior(poi, p);
+
+      lnpmax = *max_element(p.begin(), p.end());
+      if ( lnpmax == -HUGE_VAL ) lnpmax = 0.0;
+      int first = -1;
+      int last  = -1;
+      for(int i=0; i < nsteps+1; i++)
+	{
+	  p[i] = exp(p[i] - lnpmax);
+	  if ( p[i] < factor ) continue;
+	  if ( first < 0 ) first = i;
+	  last = i;
+	}
+      warm = first >= 0 
+	&& ( first > 0 || _poimin <= 0 ) 
+	&& last < nsteps
+	&& last - first >= nsteps / 3;
+    }
+
+  // otherwise, find the support afresh, starting from the bounds 
+  // given to the constructor, so that it does not depend on the 
+  // previous data
+  if ( ! warm )
+    {
+      _poimin = _poilower;
+      _poimax = _poiupper;
+      step = 0;
+    }
+  for(int ii=0; ii < 2 && ! warm; ii++)
     {
       double pmax = 0.0;
       int    mode = 0;
       _poimax += step;      
       step = (_poimax - _poimin) / nsteps;
+
+      for(int i=0; i < nsteps+1; i++) poi[i] = _poimin + i*step;
+      _loglikeprior(poi, p);
       
+      lnpmax = -HUGE_VAL;
       for(int i=0; i < nsteps+1; i++)
   	{
-  	  double xx = _poimin + i*step;
-  	  p[i] = _likeprior(xx);
-      
-  	  if ( p[i] > pmax )
+  	  if ( p[i] > lnpmax )
   	    {
-  	      pmax = p[i];
+  	      lnpmax = p[i];
   	      mode = i;
   	    }
   	}
+      if ( lnpmax == -HUGE_VAL ) lnpmax = 0.0;
+      for(int i=0; i < nsteps+1; i++)
+	{
+	  p[i] = exp(p[i] - lnpmax);
+	  if ( p[i] > pmax ) pmax = p[i];
+	}
 
       // find left edge of support
-      double factor = 1.e-5;
       int jj = 0;
       for(int i=0; i < mode; i++)
   	{
@@ -197,88 +289,194 @@ Bayes::normalize()
   assert( _poimax > _poimin );
 
   // now that wew have the support, calculate the unnormalized posterior
-  // density at equal intervals;
-  step = (_poimax - _poimin) / nsteps;
-  for(int i=0; i < nsteps+1; i++)
+  // density at equal intervals (already done if warm started)
+  if ( ! warm )
     {
-      double xx = _poimin + i*step;
-      p[i] = _likeprior(xx);
+      step = (_poimax - _poimin) / nsteps;
+      for(int i=0; i < nsteps+1; i++) poi[i] = _poimin + i*step;
+      _loglikeprior(poi, p);
+      for(int i=0; i < nsteps+1; i++) p[i] = exp(p[i] - lnpmax);
     }
 
+  // Tabulate the cdf by adaptive Simpson integration, starting from 
+  // the panels of the grid. Each pass computes the density at the 
+  // quarter points of all panels that are not yet accurate enough, so
+  // that the likelihood is computed in parallel. The error of a panel
+  // is estimated from the change, when the panel is halved, of its 
+  // Simpson sum and of the cdf at its midpoint interpolated with a 
+  // cubic Hermite polynomial. A panel is accurate enough when its error
+  // is within its share, in proportion to its width, of the tolerance.
+  // Since the number of panels can double with each pass, all panels
+  // are accepted once halving them would exceed the budget of 
+  // likelihood calculations (or after MAXPASSES passes).
+  vector<Panel> active;
+  double total = 0;
+  for(int i=0; i+2 < nsteps+1; i+=2)
+    {
+      Panel panel = {poi[i], poi[i+2], p[i], p[i+1], p[i+2], 0, 0};
+      active.push_back(panel);
+      total += (poi[i+2] - poi[i]) * (p[i] + 4*p[i+1] + p[i+2]) / 6;
+    }
   
-  // ROOT::Math::WrappedMemFunction<Bayes, double (Bayes::*)(double)> 
-  //   fn(*this, &Bayes::_likeprior);
-  // ROOT::Math::Integrator ifn(fn);
-  // _normalization = ifn.Integral(_poimin, _poimax);
-  // _normalize = false;
-
-  // // compute posterior density over its support
-  // step = (_poimax - _poimin)/ _nsteps;
-  // for(int i=0; i < _nsteps+1; i++)
-  //   {
-  //     double poi = _poimin + i*step;
-  //     p[i] = posterior(poi);
-  //     //printf("%10.3f\t%10.3e\n", poi, p[i]);
-  //   }
-
-  // Compute cdf at several points
-
-  step *= 2;
-  double scale = step / 6;
-  _x.resize(_nsteps+1);
-  _y.resize(_nsteps+1);
-  _x[0] = _poimin;
-  _y[0] = 0;
-  for(int i=1; i < nsteps+1; i+=2)
+  double range = _poimax - _poimin;
+  double error = 0;
+  vector<Panel> done;
+  vector<Panel> next;
+  vector<double> x;
+  vector<double> lnq;
+  vector<double> errs;
+  for(int pass=0; ! active.empty(); pass++)
+    {
+      int npanels = (int)active.size();
+      x.resize(2*npanels);
+      for(int k=0; k < npanels; k++)
+	{
+	  Panel& panel = active[k];
+	  double m = (panel.a + panel.b) / 2;
+	  x[2*k]   = (panel.a + m) / 2;
+	  x[2*k+1] = (m + panel.b) / 2;
+	}
+      _loglikeprior(x, lnq);
+      
+      // the error of each panel, and the cost of the next pass
+      errs.resize(npanels);
+      int nsplit = 0;
+      for(int k=0; k < npanels; k++)
+	{
+	  Panel& panel = active[k];
+	  double h  = panel.b - panel.a;
+	  double fl = exp(lnq[2*k]   - lnpmax);
+	  double fr = exp(lnq[2*k+1] - lnpmax);
+	  double S  = h * (panel.fa + 4*panel.fm + panel.fb) / 6;
+	  double SL = h * (panel.fa + 4*fl + panel.fm) / 12;
+	  double SR = h * (panel.fm + 4*fr + panel.fb) / 12;
+	  double FH = S / 2 + h * (panel.fa - panel.fb) / 8;
+	  errs[k] = max(abs(SL + SR - S) / 15, abs(FH - SL) / 16);
+	  if ( errs[k] > _tolerance * total * h / range ) nsplit++;
+	}
+      bool last = pass == MAXPASSES || 
+	_nevaluations + 4 * nsplit > _maxevaluations;
+
+      next.clear();
+      for(int k=0; k < npanels; k++)
+	{
+	  Panel& panel = active[k];
+	  double h  = panel.b - panel.a;
+	  double m  = (panel.a + panel.b) / 2;
+	  double fl = exp(lnq[2*k]   - lnpmax);
+	  double fr = exp(lnq[2*k+1] - lnpmax);
+	  double SL = h * (panel.fa + 4*fl + panel.fm) / 12;
+	  double SR = h * (panel.fm + 4*fr + panel.fb) / 12;
+	  double err = errs[k];
+	  if ( err <= _tolerance * total * h / range || last )
+	    {
+	      panel.left  = SL;
+	      panel.right = SR;
+	      done.push_back(panel);
+	      error += err;
+	    }
+	  else
+	    {
+	      Panel L = {panel.a, m, panel.fa, fl, panel.fm, 0, 0};
+	      Panel R = {m, panel.b, panel.fm, fr, panel.fb, 0, 0};
+	      next.push_back(L);
+	      next.push_back(R);
+	    }
+	}
+      active.swap(next);
+    }
+  sort(done.begin(), done.end());
+
+  // tabulate the cdf and the density at the ends and midpoint 
+  // of each panel
+  _x.clear();
+  _y.clear();
+  _f.clear();
+  double sum = 0;
+  for(size_t k=0; k < done.size(); k++)
     {
-      int j = (i + 1) / 2;
-      _x[j] = _poimin + j * step;
-      _y[j] = _y[j-1] + scale *  (p[i+1] + 4 * p[i] + p[i-1]);
-      //printf("i[%d], j[%d], _x[%f], _y[%e]\n", i, j, _x[j], _y[j]);
+      Panel& panel = done[k];
+      _x.push_back(panel.a);
+      _y.push_back(sum);
+      _f.push_back(panel.fa);
+      _x.push_back((panel.a + panel.b) / 2);
+      _y.push_back(sum + panel.left);
+      _f.push_back(panel.fm);
+      sum += panel.left + panel.right;
     }
-  assert(abs(_x.back() - _poimax) < 1.e-4 * _poimax);
-  _poimax = _x.back();
+  _x.push_back(_poimax);
+  _y.push_back(sum);
+  _f.push_back(done.back().fb);
   
-  _normalization = _y.back();
-  for(int i=0; i < _nsteps+1; i++) _y[i] /= _normalization;
-  _normalize = false;
-
-  if ( _interp != 0 )
+  _normalization = sum;
+  for(size_t i=0; i < _y.size(); i++) 
     {
-      delete _interp;
-      _interp = 0;
+      _y[i] /= _normalization;
+      _f[i] /= _normalization;
     }
-  if ( _interp == 0)
-    _interp = new ROOT::Math::Interpolator(_x.size(),
-					   ROOT::Math::
-					   Interpolation::kLINEAR);
-					   //Interpolation::kCSPLINE);
-  _interp->SetData(_x, _y);
+  _error = error / _normalization;
 
+  // limit the slopes of the interpolating polynomials so that the
+  // interpolated cdf cannot decrease (Fritsch and Carlson, 1980)
+  _d = _f;
+  for(size_t i=0; i+1 < _x.size(); i++)
+    {
+      double delta = (_y[i+1] - _y[i]) / (_x[i+1] - _x[i]);
+      if ( delta <= 0 )
+	{
+	  _d[i] = _d[i+1] = 0;
+	  continue;
+	}
+      double alpha = _d[i] / delta;
+      double beta  = _d[i+1] / delta;
+      double norm  = alpha*alpha + beta*beta;
+      if ( norm > 9 )
+	{
+	  double tau = 3 / sqrt(norm);
+	  _d[i]   = tau * alpha * delta;
+	  _d[i+1] = tau * beta  * delta;
+	}
+    }
+  _lnnormalization = log(_normalization) + lnpmax;
+  _normalization   = exp(_lnnormalization);
+  _normalize = false;
+  _tabulated = true;
+
+  if ( _error > _tolerance && _verbosity > -1 )
+    cout << "Bayes::normalize: cdf error " << _error 
+	 << " exceeds the tolerance " << _tolerance
+	 << " after " << _nevaluations << " likelihood evaluations" << endl;
+  if ( _verbosity > 0 )
+    cout << "Bayes::normalize: " << _x.size() << " points, "
+	 << _nevaluations << " likelihood evaluations, cdf error "
+	 << _error << endl;
+  
   return _normalization;
 }
 
 double 
 Bayes::posterior(double poi)
+{
+  return exp(logPosterior(poi));
+}
+
+double 
+Bayes::logPosterior(double poi)
 {
   if ( _normalize ) normalize();
-  return _likeprior(poi) / _normalization;
+  return _loglikeprior(poi) - _lnnormalization;
 }
 
 double 
 Bayes::cdf(double poi)
 {
+  if ( _normalize ) normalize();
   if ( poi < _poimin ) 
     return 0;
   else if ( poi > _poimax )
     return 1;
 
-  if ( _normalize ) normalize();
-  // Compute CDF
-  ROOT::Math::WrappedMemFunction<Bayes, double (Bayes::*)(double)> 
-    fn(*this, &Bayes::posterior);
-  ROOT::Math::Integrator ifn(fn);
-  return ifn.Integral(_poimin, poi);
+  return _cdf(poi);
 }
 
 double 
@@ -287,51 +485,106 @@ Bayes::percentile(double p)
   if ( p > 0 ) _cl = p; // Credibility level
   if ( _normalize ) normalize();
 
-  // function whose root is to be found
-  ROOT::Math::WrappedMemFunction<Bayes, double (Bayes::*)(double)> 
-    fn(*this, &Bayes::_q);
-  ROOT::Math::RootFinder rootfinder;
-  
-  rootfinder.SetFunction(fn, _poimin, _poimax);
-  int status = rootfinder.Solve();
-  if ( status != 1 )
-    {
-      cout << "*** Bayes *** RootFinder failed to find quantile"
-           << endl;
-      return -1;
-    }
-  return rootfinder.Root();
+  // the error in the cdf translates into an error in the percentile
+  double poi = _inverse(_cl);
+  double density = _density(poi);
+  _perror = density > 0 ? _error / density : 0;
+  return poi;
+}
+
+vector<double>
+Bayes::percentiles(vector<double>& p)
+{
+  if ( _normalize ) normalize();
+  vector<double> poi(p.size());
+  for(size_t i=0; i < p.size(); i++) poi[i] = _inverse(p[i]);
+  return poi;
+}
+
+pair<double, double>
+Bayes::HPD(double cl_)
+{
+  if ( _normalize ) normalize();
+  if ( cl_ >= 1 ) return pair<double, double>(_x.front(), _x.back());
+
+  // find the probability u below the interval [x(u), x(u + cl)] that
+  // minimizes its width
+  BrentMinimizer minimizer(0, 1 - cl_, 1.e-10);
+  minimizer.minimize([this, cl_](double u) 
+		     { return _inverse(u + cl_) - _inverse(u); },
+		     (1 - cl_) / 2);
+  double u = minimizer.x();
+  return pair<double, double>(_inverse(u), _inverse(u + cl_));
+}
+
+void
+Bayes::reset()
+{
+  _tabulated = false;
+  _MAPdone = false;
+  _result = pair<double, double>(0, 0);
 }
 
 pair<double, double>
 Bayes::MAP(double cl_)
 {
   if ( _MAPdone ) return _result;
-  if ( _normalize ) normalize();
-  
-  TMinuit minuit(1);
-  minuit.SetPrintLevel(_verbosity);
-  minuit.SetFCN(nlpFunc);
-
-  double chi2 = TMath::NormQuantile((1.0+cl_)/2);
-  chi2 = chi2*chi2/2;  
-  minuit.SetErrorDef(chi2);
-
-  int status=0;
-  double guess = (_poimax+_poimin)/2;
-  double stepsize = (_poimax-_poimin)/10000;
-  minuit.mnparm(0, "poi", guess, stepsize, 
-		_poimin, _poimax, status);
-  double args[2] = {MAXITER, TOLERANCE};
-  minuit.mnexcm("MIGRAD", args, 2, status);
+
+  // the mode does not depend on the normalization, so the posterior
+  // density need not be tabulated
+
+  // warm start from the previous mode, if there was one. The search
+  // covers the bounds given to the constructor, since the current 
+  // support may have been found for other data.
+  double guess = (_poiupper+_poilower)/2;
+  double stepsize = (_poiupper-_poilower)/100;
+  if ( _result.second > 0 && 
+       _result.first > _poilower && _result.first < _poiupper )
+    {
+      guess = _result.first;
+      stepsize = _result.second;
+    }
+
+  BrentMinimizer minimizer(_poilower, _poiupper);
+  int status;
+  double lnL0, d10, d20;
+  bool flat = _prior == 0;
+#ifdef __WITH_ROOFIT__
+  flat = flat && _rfprior == 0;
+#endif
+  if ( flat && _cache.derivatives(_data, guess, lnL0, d10, d20) )
+    {
+      // with a flat prior the mode is that of the likelihood, which
+      // is found by Newton's method if the model provides derivatives
+      status = minimizer.minimize([&](double poi, double& f, 
+				      double& df, double& d2f)
+				  {
+				    if ( poi == guess )
+				      {
+					f = lnL0; df = d10; d2f = d20;
+				      }
+				    else
+				      _cache.derivatives(_data, poi, f, df, d2f);
+				    f = -f; df = -df; d2f = -d2f;
+				  }, guess);
+    }
+  else
+    status = minimizer.minimize([this](double poi) 
+				{ return -_loglikeprior(poi); },
+				guess, stepsize);
   if ( status != 0 )
     {
       cout << "Bayes::MAP failed to find MAP" << endl;
       return pair<double, double>(0,0);
     }
   
-  // get fit result
-  minuit.GetParameter(0, _result.first, _result.second);
+  // get fit result: the uncertainty is the half-width of the
+  // parabola -ln p = chi2 above the minimum, with chi2 = z^2/2
+  double z = TMath::NormQuantile((1.0+cl_)/2);
+  _result.first  = minimizer.x();
+  _result.second = 0;
+  if ( minimizer.curvature() > 0 )
+    _result.second = z / sqrt(minimizer.curvature());
   
   _MAPdone = true;
   
@@ -350,16 +603,21 @@ void
 Bayes::setData(std::vector<double>& d)
 {
   _data = d;
-  normalize();
+  clearCache();
+}
+
+void
+Bayes::clearCache()
+{
+  _cache.clear();
+  _normalize = true;
   _MAPdone = false;
 }
 
 double 
 Bayes::zvalue(double poi)
 {
-  double N = likelihood(poi);
-  double D = likelihood(0);
-  double lnB10 = log(N/D);
+  double lnB10 = logLikelihood(poi) - logLikelihood(0);
   if ( lnB10 != lnB10 )
     {
       cout << "*** Bayes - this is Baaaad! lnB10 = " 
@@ -397,13 +655,123 @@ Bayes::_likeprior(double poi)
 }
 
 double 
-Bayes::_q(double poi)
+Bayes::_loglikeprior(double poi)
 {
-  if ( poi < _poimin ) 
-    return 0;
-  else if ( poi > _poimax )
-    return 1;
+  if ( poi != poi )
+    {
+      cout << "*** Bayes - this is Baaaad! poi = " 
+           << poi << endl;
+      exit(0);
+    }
+  return logLikelihood(poi) + log(prior(poi));
+}
+
+void 
+Bayes::_loglikeprior(std::vector<double>& poi, std::vector<double>& lnp)
+{
+  // compute the likelihood at all points, splitting the points
+  // between threads if the model allows it
+  int npoints = (int)poi.size();
+  int nchunks = 1;
+  ThreadPool& pool = ThreadPool::instance();
+  if ( _cache.reentrant() ) nchunks = min(pool.size(), npoints);
+
+  // count only the points not found in the cache
+  long misses = _cache.misses();
+  if ( nchunks <= 1 )
+    _cache.evaluate(_data, poi, lnp, true);
   else
-     return _interp->Eval(poi) - _cl;
+    {
+      lnp.resize(npoints);
+      int chunksize = (npoints + nchunks - 1) / nchunks;
+      pool.run(nchunks, [&](int chunk)
+	       {
+		 int first = chunk * chunksize;
+		 int last  = min(first + chunksize, npoints);
+		 if ( first >= last ) return;
+		 vector<double> x(poi.begin() + first, poi.begin() + last);
+		 vector<double> y;
+		 _cache.evaluate(_data, x, y, true);
+		 copy(y.begin(), y.end(), lnp.begin() + first);
+	       });
+    }
+  
+  _nevaluations += (int)(_cache.misses() - misses);
+  
+  // the prior may be user code, so compute it serially
+  for(int i=0; i < npoints; i++) lnp[i] += log(prior(poi[i]));
+}
+
+double
+Bayes::_cdf(double poi)
+{
+  // interpolate with the cubic Hermite polynomial that matches the cdf
+  // and its (limited) derivative at the ends of each interval
+  if ( poi <= _x.front() ) return 0;
+  if ( poi >= _x.back() ) return 1;
+  int i = (int)(upper_bound(_x.begin(), _x.end(), poi) - _x.begin()) - 1;
+  double h  = _x[i+1] - _x[i];
+  double t  = (poi - _x[i]) / h;
+  double t2 = t * t;
+  double t3 = t2 * t;
+  return 
+    (2*t3 - 3*t2 + 1) * _y[i] + (t3 - 2*t2 + t) * h * _d[i] +
+    (3*t2 - 2*t3) * _y[i+1]   + (t3 - t2) * h * _d[i+1];
+}
+
+double
+Bayes::_inverse(double prob)
+{
+  if ( prob <= 0 ) return _x.front();
+  if ( prob >= 1 ) return _x.back();
+
+  // find the interval that contains the probability...
+  int n = (int)_y.size();
+  int i = (int)(upper_bound(_y.begin(), _y.end(), prob) - _y.begin()) - 1;
+  if ( i < 0 ) return _x.front();
+  if ( i > n - 2 ) return _x.back();
+
+  // ...and solve cubic = prob by Newton's method, safeguarded by 
+  // bisection; since the cubic is monotonic, the root is unique
+  double h  = _x[i+1] - _x[i];
+  double y0 = _y[i];
+  double y1 = _y[i+1];
+  double d0 = h * _d[i];
+  double d1 = h * _d[i+1];
+  double lo = 0;
+  double hi = 1;
+  double t  = (prob - y0) / (y1 - y0);
+  for(int iter=0; iter < 100; iter++)
+    {
+      double t2 = t * t;
+      double t3 = t2 * t;
+      double y  = (2*t3 - 3*t2 + 1) * y0 + (t3 - 2*t2 + t) * d0 +
+	(3*t2 - 2*t3) * y1 + (t3 - t2) * d1;
+      double dy = (6*t2 - 6*t) * (y0 - y1) + (3*t2 - 4*t + 1) * d0 +
+	(3*t2 - 2*t) * d1;
+      if ( y < prob ) 
+	lo = t;
+      else
+	hi = t;
+      double tnew = dy > 0 ? t - (y - prob) / dy : -1;
+      if ( tnew <= lo || tnew >= hi ) tnew = (lo + hi) / 2;
+      if ( abs(tnew - t) < 1.e-14 ) 
+	{
+	  t = tnew;
+	  break;
+	}
+      t = tnew;
+    }
+  return _x[i] + t * h;
+}
+
+double
+Bayes::_density(double poi)
+{
+  if ( poi < _x.front() || poi > _x.back() ) return 0;
+  int i = (int)(upper_bound(_x.begin(), _x.end(), poi) - _x.begin()) - 1;
+  if ( i >= (int)_x.size() - 1 ) return _f.back();
+  double t = (poi - _x[i]) / (_x[i+1] - _x[i]);
+  return (1 - t) * _f[i] + t * _f[i+1];
 }
 
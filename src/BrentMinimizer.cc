@@ -0,0 +1,256 @@
+//--------------------------------------------------------------
+// File: BrentMinimizer.cc
+// Description: Reentrant minimizer of a function of one variable
+//              on a bounded interval.
+//--------------------------------------------------------------
+#include <cmath>
+#include <algorithm>
+#include "BrentMinimizer.h"
+
+using namespace std;
+
+BrentMinimizer::BrentMinimizer(double xmin, double xmax, 
+			       double tolerance, int maxiter)
+  : _xmin(xmin),
+    _xmax(xmax),
+    _tolerance(tolerance),
+    _maxiter(maxiter),
+    _x(xmin),
+    _fval(0),
+    _curvature(0),
+    _ncalls(0)
+{
+  if ( _tolerance <= 0 ) _tolerance = 1.e-8 * (_xmax - _xmin);
+}
+
+double
+BrentMinimizer::difference(const function<double(double)>& f, 
+			   double x, double fx, double h)
+{
+  // central difference if the points, moved towards x if need be, 
+  // lie within the interval
+  double hc = min(h, min(x - _xmin, _xmax - x));
+  if ( hc >= h / 8 )
+    {
+      // use the steps that are actually represented
+      double hm = x - (x - hc);
+      double hp = (x + hc) - x;
+      double fm = f(x - hm); _ncalls++;
+      double fp = f(x + hp); _ncalls++;
+      return 2 * (hm * (fp - fx) + hp * (fm - fx)) / (hm * hp * (hm + hp));
+    }
+  
+  // otherwise one-sided
+  double x0 = min(max(x - h, _xmin), _xmax - 2 * h);
+  double f0 = x0 == x ? fx : (_ncalls++, f(x0));
+  double f1 = x0 + h == x ? fx : (_ncalls++, f(x0 + h));
+  double f2 = f(x0 + 2 * h); _ncalls++;
+  return (f2 - 2 * f1 + f0) / (h * h);
+}
+
+int 
+BrentMinimizer::minimize(const function<double(double)>& f, 
+			 double guess, double step)
+{
+  _ncalls = 0;
+  if ( step <= 0 ) step = (_xmax - _xmin) / 100;
+  double x = min(max(guess, _xmin), _xmax);
+  double fx = f(x); _ncalls++;
+
+  // 1. bracket the minimum by walking downhill from x
+  double a  = max(x - step, _xmin);
+  double fa = a < x ? f(a) : fx; 
+  if ( a < x ) _ncalls++;
+  double b  = min(x + step, _xmax);
+  double fb = b > x ? f(b) : fx;
+  if ( b > x ) _ncalls++;
+
+  while ( fa < fx && a > _xmin )
+    {
+      step *= 2;
+      b  = x; fb = fx;
+      x  = a; fx = fa;
+      a  = max(x - step, _xmin);
+      fa = f(a); _ncalls++;
+    }
+  while ( fb < fx && b < _xmax )
+    {
+      step *= 2;
+      a  = x; fa = fx;
+      x  = b; fx = fb;
+      b  = min(x + step, _xmax);
+      fb = f(b); _ncalls++;
+    }
+  
+  // if the walk stopped at a boundary, the minimum may lie on it,
+  // which Brent's method would approach only slowly
+  if ( fa <= fx && a == _xmin )
+    {
+      double fu = f(a + _tolerance); _ncalls++;
+      if ( fa <= fu ) { x = a; fx = fa; b = a; }
+    }
+  else if ( fb <= fx && b == _xmax )
+    {
+      double fu = f(b - _tolerance); _ncalls++;
+      if ( fb <= fu ) { x = b; fx = fb; a = b; }
+    }
+
+  // 2. Brent's method on [a, b] starting at x
+  // (R.P. Brent, Algorithms for Minimization without Derivatives, 1973)
+  const double C   = 0.5 * (3 - sqrt(5.0));
+  const double EPS = 1.5e-8;
+  double v  = x, w  = x;
+  double fv = fx, fw = fx;
+  double d  = 0, e  = 0;
+  int status = 1;
+  for(int iter=0; iter < _maxiter; iter++)
+    {
+      double xm   = 0.5 * (a + b);
+      double tol1 = EPS * fabs(x) + _tolerance / 3;
+      double tol2 = 2 * tol1;
+      if ( fabs(x - xm) <= tol2 - 0.5 * (b - a) )
+	{
+	  status = 0;
+	  break;
+	}
+
+      bool golden = true;
+      if ( fabs(e) > tol1 )
+	{
+	  // try a parabolic fit through x, v and w
+	  double r = (x - w) * (fx - fv);
+	  double q = (x - v) * (fx - fw);
+	  double p = (x - v) * q - (x - w) * r;
+	  q = 2 * (q - r);
+	  if ( q > 0 ) p = -p;
+	  q = fabs(q);
+	  double etemp = e;
+	  e = d;
+	  if ( fabs(p) < fabs(0.5 * q * etemp) && 
+	       p > q * (a - x) && p < q * (b - x) )
+	    {
+	      d = p / q;
+	      double u = x + d;
+	      if ( u - a < tol2 || b - u < tol2 ) d = xm > x ? tol1 : -tol1;
+	      golden = false;
+	    }
+	}
+      if ( golden )
+	{
+	  e = x >= xm ? a - x : b - x;
+	  d = C * e;
+	}
+      
+      double u  = fabs(d) >= tol1 ? x + d : x + (d > 0 ? tol1 : -tol1);
+      double fu = f(u); _ncalls++;
+      if ( fu <= fx )
+	{
+	  if ( u >= x ) a = x; else b = x;
+	  v = w; fv = fw;
+	  w = x; fw = fx;
+	  x = u; fx = fu;
+	}
+      else
+	{
+	  if ( u < x ) a = u; else b = u;
+	  if ( fu <= fw || w == x )
+	    {
+	      v = w; fv = fw;
+	      w = u; fw = fu;
+	    }
+	  else if ( fu <= fv || v == x || v == w )
+	    {
+	      v = u; fv = fu;
+	    }
+	}
+    }
+
+  // Brent's method never evaluates the end points, so check whether
+  // the minimum is on a boundary
+  if ( a < b && x - _xmin < 2 * _tolerance )
+    {
+      double f0 = f(_xmin); _ncalls++;
+      if ( f0 <= fx ) { x = _xmin; fx = f0; }
+    }
+  else if ( a < b && _xmax - x < 2 * _tolerance )
+    {
+      double f1 = f(_xmax); _ncalls++;
+      if ( f1 <= fx ) { x = _xmax; fx = f1; }
+    }
+  _x    = x;
+  _fval = fx;
+  
+  // 3. second derivative at the minimum by finite differences. The
+  // step is scaled to the width of the minimum: it is chosen so that 
+  // f rises by a fraction RISE of its magnitude, which is large 
+  // compared with rounding errors but small enough that the skewness 
+  // of f does not bias the estimate. The first estimate, from a fixed
+  // fraction of the interval, is refined until the step is consistent
+  // with the curvature; a step for which f is not finite, or not 
+  // convex, is reduced. The differences are central, unless x is too
+  // close to a boundary, where they are one-sided.
+  const double RISE = 1.e-6;
+  double hmin = 1.e-12 * (fabs(x) + _xmax - _xmin);
+  double hmax = (_xmax - _xmin) / 4;
+  double h = 1.e-4 * (_xmax - _xmin);
+  for(int iter=0; iter < 8; iter++)
+    {
+      _curvature = difference(f, x, fx, h);
+      if ( ! (_curvature > 0 && _curvature < HUGE_VAL) )
+	{
+	  if ( h / 10 < hmin ) break;
+	  h /= 10;
+	  continue;
+	}
+      double hnew = sqrt(2 * RISE * max(fabs(fx), 1.0) / _curvature);
+      hnew = min(max(hnew, hmin), hmax);
+      if ( hnew > h / 2 && hnew < 2 * h ) break;
+      h = hnew;
+    }
+  return status;
+}
+
+int 
+BrentMinimizer::minimize(const function<void(double, double&, double&, 
+					      double&)>& fdf, 
+			 double guess)
+{
+  _ncalls = 0;
+  double lo = _xmin;
+  double hi = _xmax;
+  double x  = min(max(guess, _xmin), _xmax);
+  double fx=0, df=0, d2f=0;
+  int status = 1;
+  for(int iter=0; iter < _maxiter; iter++)
+    {
+      fdf(x, fx, df, d2f); _ncalls++;
+
+      // the minimum lies on the downhill side of x
+      if ( df > 0 ) 
+	hi = x;
+      else if ( df < 0 ) 
+	lo = x;
+      else
+	{
+	  status = 0;
+	  break;
+	}
+      
+      // Newton step, replaced by bisection if it leaves the bracket
+      // or if the function is not convex here
+      double xnew = d2f > 0 ? x - df / d2f : 0.5 * (lo + hi);
+      if ( ! (xnew > lo && xnew < hi) ) xnew = 0.5 * (lo + hi);
+      if ( fabs(xnew - x) < _tolerance || hi - lo < _tolerance )
+	{
+	  x = xnew;
+	  fdf(x, fx, df, d2f); _ncalls++;
+	  status = 0;
+	  break;
+	}
+      x = xnew;
+    }
+  _x    = x;
+  _fval = fx;
+  _curvature = d2f;
+  return status;
+}
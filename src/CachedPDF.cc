@@ -0,0 +1,195 @@
+//--------------------------------------------------------------
+// File: CachedPDF.cc
+// Description: Cache the log-likelihoods computed by a model.
+//--------------------------------------------------------------
+#include <cmath>
+#include "CachedPDF.h"
+
+using namespace std;
+
+CachedPDF::CachedPDF()
+  : PDFunction(),
+    _model(0),
+    _ownmodel(false),
+    _maxsize(MAXSIZE),
+    _version(0),
+    _hits(0),
+    _misses(0),
+    _data(vector<double>()),
+    _table(unordered_map<double, double>())
+{}
+
+CachedPDF::CachedPDF(PDFunction& model, int maxsize)
+  : PDFunction(),
+    _model(&model),
+    _ownmodel(false),
+    _maxsize(maxsize),
+    _version(0),
+    _hits(0),
+    _misses(0),
+    _data(vector<double>()),
+    _table(unordered_map<double, double>())
+{}
+
+CachedPDF::CachedPDF(const CachedPDF& o)
+  : PDFunction(),
+    _model(o._model),
+    _ownmodel(false),
+    _maxsize(o._maxsize),
+    _version(o._version),
+    _hits(0),
+    _misses(0),
+    _data(o._data),
+    _table(o._table)
+{}
+
+CachedPDF& 
+CachedPDF::operator=(const CachedPDF& o)
+{
+  if ( this == &o ) return *this;
+  std::lock_guard<std::mutex> lock(_lock);
+  if ( _ownmodel ) delete _model;
+  _model    = o._model;
+  _ownmodel = false;
+  _maxsize  = o._maxsize;
+  _version  = o._version;
+  _hits     = 0;
+  _misses   = 0;
+  _data     = o._data;
+  _table    = o._table;
+  return *this;
+}
+
+CachedPDF::~CachedPDF()
+{
+  if ( _ownmodel ) delete _model;
+}
+
+PDFunction*
+CachedPDF::clone()
+{
+  if ( _model == 0 ) return 0;
+  PDFunction* model = _model->clone();
+  if ( model == 0 ) return 0;
+  CachedPDF* cached = new CachedPDF(*model, _maxsize);
+  cached->_ownmodel = true;
+  return cached;
+}
+
+void
+CachedPDF::clear()
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _table.clear();
+  _version++;
+}
+
+vector<double>& 
+CachedPDF::generate(double poi)
+{
+  return _model->generate(poi);
+}
+
+double 
+CachedPDF::operator() (vector<double>& data, double poi)
+{
+  return exp(logLikelihood(data, poi));
+}
+
+long
+CachedPDF::_lookup(vector<double>& data)
+{
+  // must be called with the lock held: start a new version if the
+  // data differ from those of the previous request
+  if ( data != _data )
+    {
+      _data = data;
+      _table.clear();
+      _version++;
+    }
+  return _version;
+}
+
+void
+CachedPDF::_insert(long version, double poi, double lnp)
+{
+  // must be called with the lock held. A value computed for an older
+  // version is dropped.
+  if ( version != _version ) return;
+  if ( poi != poi ) return;
+  if ( (int)_table.size() >= _maxsize ) _table.clear();
+  _table[poi] = lnp;
+}
+
+double 
+CachedPDF::logLikelihood(vector<double>& data, double poi)
+{
+  long version;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    version = _lookup(data);
+    unordered_map<double, double>::iterator it = _table.find(poi);
+    if ( it != _table.end() )
+      {
+	_hits++;
+	return it->second;
+      }
+    _misses++;
+  }
+  
+  // compute outside the lock, so that a reentrant model can be 
+  // used by several threads at once
+  double lnp = _model->logLikelihood(data, poi);
+
+  std::lock_guard<std::mutex> lock(_lock);
+  _insert(version, poi, lnp);
+  return lnp;
+}
+
+void
+CachedPDF::evaluate(vector<double>& data,
+		    vector<double>& poi,
+		    vector<double>& result,
+		    bool uselog)
+{
+  int npoi = (int)poi.size();
+  result.resize(npoi);
+
+  // get the cached values and note which are missing
+  vector<int> index;
+  vector<double> missing;
+  long version;
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    version = _lookup(data);
+    for(int j=0; j < npoi; j++)
+      {
+	unordered_map<double, double>::iterator it = _table.find(poi[j]);
+	if ( it != _table.end() )
+	  result[j] = it->second;
+	else
+	  {
+	    index.push_back(j);
+	    missing.push_back(poi[j]);
+	  }
+      }
+    _hits   += npoi - (long)missing.size();
+    _misses += (long)missing.size();
+  }
+
+  if ( missing.size() > 0 )
+    {
+      vector<double> lnp;
+      _model->evaluate(data, missing, lnp, true);
+      
+      std::lock_guard<std::mutex> lock(_lock);
+      for(size_t c=0; c < missing.size(); c++)
+	{
+	  result[index[c]] = lnp[c];
+	  _insert(version, missing[c], lnp[c]);
+	}
+    }
+  
+  if ( ! uselog )
+    for(int j=0; j < npoi; j++) result[j] = exp(result[j]);
+}
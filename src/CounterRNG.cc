@@ -0,0 +1,581 @@
+//--------------------------------------------------------------
+// File: CounterRNG.cc
+// Description: Counter-based random number generator with
+//              independent, reproducible streams.
+//--------------------------------------------------------------
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "CounterRNG.h"
+#include "VectorMath.h"
+
+using namespace std;
+
+namespace {
+  // Philox4x32 multipliers and Weyl key increments
+  const uint32_t M0=0xD2511F53;
+  const uint32_t M1=0xCD9E8D57;
+  const uint32_t W0=0x9E3779B9;
+  const uint32_t W1=0xBB67AE85;
+
+  inline void mulhilo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo)
+  {
+    uint64_t p = (uint64_t)a * b;
+    hi = (uint32_t)(p >> 32);
+    lo = (uint32_t)p;
+  }
+
+  // below this mean, Poisson variates are generated by inversion;
+  // above it, by transformed rejection
+  const double POISSONSWITCH=10;
+  const double POISSONCUTOFF=100;
+
+  const int NBLOCKS=CounterRNG::BUFFERSIZE / 4;
+
+  // counters, keys, and destinations of the blocks computed by fill()
+  struct Blocks
+  {
+    vector<uint64_t> x0, x1, x2, x3, k0, k1;
+    vector<uint32_t*> dest;
+  };
+  thread_local Blocks BLOCKS;
+
+  // work space of the batch samplers
+  struct Trials
+  {
+    vector<double> d, c, z, u1, u2, u3;
+    void resize(int m)
+    {
+      d.resize(m); c.resize(m); z.resize(m);
+      u1.resize(m); u2.resize(m); u3.resize(m);
+    }
+  };
+  thread_local Trials TRIALS;
+
+#if defined(__GNUC__)
+  using namespace VectorMath;
+
+  // the trials are always made a whole vector at a time, so that a
+  // variate does not depend on the number drawn together with it
+  inline int padded(int n) { return VSIZE * ((n + VSIZE - 1) / VSIZE); }
+
+  /// First Marsaglia-Tsang trial of n gamma variates of shape d + 1/3,
+  /// with c = 1/sqrt(9d). If u1 > 0, the normal variate is computed 
+  /// from (u1, u2) and u2 is replaced by the second normal variate; 
+  /// otherwise the normal variate is z. u3 is replaced by the variate,
+  /// or -1 if the trial is rejected.
+  SIMD_CLONES
+  void gammaTrials(int n, const double* d, const double* c, 
+		   const double* z, const double* u1, double* u2, 
+		   double* u3)
+  {
+    for(int k=0; k < n; k += VSIZE)
+      {
+	vdouble zero = {};
+	vdouble vd, vc, vz, v1, v2, v3;
+	memcpy(&vd, d + k, sizeof(vd));
+	memcpy(&vc, c + k, sizeof(vc));
+	memcpy(&vz, z + k, sizeof(vz));
+	memcpy(&v1, u1 + k, sizeof(v1));
+	memcpy(&v2, u2 + k, sizeof(v2));
+	memcpy(&v3, u3 + k, sizeof(v3));
+
+	// Box-Muller
+	vint boxmuller = v1 > 0.0;
+	vdouble r = boxmuller ? v1 : zero + 0.5;
+	vlog(r);
+	r = -2.0 * r;
+	for(int i=0; i < VSIZE; i++) r[i] = sqrt(r[i]);
+	vdouble s, co;
+	vsincos2pi(v2, s, co);
+	vdouble x = boxmuller ? r * co : vz;
+	s = r * s;
+
+	// accept if v > 0 and u < 1 - 0.0331 x^4, or, failing that,
+	// log(u) < x^2/2 + d (1 - v + log v)
+	vdouble v  = 1.0 + vc * x;
+	vint positive = v > 0.0;
+	v = v * v * v;
+	vdouble x2 = x * x;
+	vint squeeze = v3 < 1.0 - 0.0331 * x2 * x2;
+	vdouble lu = v3;
+	vdouble lv = positive ? v : zero + 1.0;
+	vlog(lu);
+	vlog(lv);
+	vint full = lu < 0.5 * x2 + vd * (1.0 - v + lv);
+	vint accept = positive & (squeeze | full);
+	vdouble value = accept ? vd * v : zero - 1.0;
+
+	vdouble second = boxmuller ? s : v2;
+	memcpy(u2 + k, &second, sizeof(second));
+	memcpy(u3 + k, &value, sizeof(value));
+      }
+  }
+
+  /// First PTRS trial of n Poisson variates with means mu >= 10 from
+  /// (u, v). w is replaced by the variate, or -1 if the trial is 
+  /// rejected by the squeeze; for means below 10 it is set to 
+  /// exp(-mu).
+  SIMD_CLONES
+  void poissonTrials(int n, const double* mu, const double* u, 
+		     const double* v, double* w)
+  {
+    for(int k=0; k < n; k += VSIZE)
+      {
+	vdouble zero = {};
+	vdouble vm, vu, vv;
+	memcpy(&vm, mu + k, sizeof(vm));
+	memcpy(&vu, u + k, sizeof(vu));
+	memcpy(&vv, v + k, sizeof(vv));
+
+	vdouble slam;
+	for(int i=0; i < VSIZE; i++) slam[i] = sqrt(vm[i]);
+	vdouble b  = 0.931 + 2.53 * slam;
+	vdouble a  = -0.059 + 0.02483 * b;
+	vdouble vr = 0.9277 - 3.6224 / (b - 2.0);
+	vdouble us = 0.5 - (vu < 0.0 ? -vu : vu);
+	vdouble kk = (2.0 * a / us + b) * vu + vm + 0.43;
+	vfloor(kk);
+	vint fast = (us >= 0.07) & (vv <= vr) & (vm < 1.e15);
+	vdouble value = fast ? kk : zero - 1.0;
+
+	vdouble limit = -vm;
+	vexp(limit);
+	value = vm < POISSONSWITCH ? limit : value;
+	memcpy(w + k, &value, sizeof(value));
+      }
+  }
+
+  /// u[i] = u[i]^p[i] for u in (0, 1].
+  SIMD_CLONES
+  void powers(int n, double* u, const double* p)
+  {
+    for(int k=0; k < n; k += VSIZE)
+      {
+	vdouble vu, vp;
+	memcpy(&vu, u + k, sizeof(vu));
+	memcpy(&vp, p + k, sizeof(vp));
+	vlog(vu);
+	vu = vu * vp;
+	vexp(vu);
+	memcpy(u + k, &vu, sizeof(vu));
+      }
+  }
+#else
+  inline int padded(int n) { return n; }
+
+  void gammaTrials(int n, const double* d, const double* c, 
+		   const double* z, const double* u1, double* u2, 
+		   double* u3)
+  {
+    for(int k=0; k < n; k++)
+      {
+	double x = z[k];
+	if ( u1[k] > 0 )
+	  {
+	    double r = sqrt(-2 * log(u1[k]));
+	    x = r * cos(2 * M_PI * u2[k]);
+	    u2[k] = r * sin(2 * M_PI * u2[k]);
+	  }
+	double v  = 1 + c[k] * x;
+	double x2 = x * x;
+	bool accept = false;
+	if ( v > 0 )
+	  {
+	    v = v * v * v;
+	    accept = u3[k] < 1 - 0.0331 * x2 * x2 ||
+	      log(u3[k]) < 0.5 * x2 + d[k] * (1 - v + log(v));
+	  }
+	u3[k] = accept ? d[k] * v : -1;
+      }
+  }
+
+  void poissonTrials(int n, const double* mu, const double* u, 
+		     const double* v, double* w)
+  {
+    for(int k=0; k < n; k++)
+      {
+	if ( mu[k] < POISSONSWITCH )
+	  {
+	    w[k] = exp(-mu[k]);
+	    continue;
+	  }
+	double b  = 0.931 + 2.53 * sqrt(mu[k]);
+	double a  = -0.059 + 0.02483 * b;
+	double vr = 0.9277 - 3.6224 / (b - 2);
+	double us = 0.5 - fabs(u[k]);
+	double kk = floor((2 * a / us + b) * u[k] + mu[k] + 0.43);
+	w[k] = us >= 0.07 && v[k] <= vr ? kk : -1;
+      }
+  }
+
+  void powers(int n, double* u, const double* p)
+  {
+    for(int k=0; k < n; k++) u[k] = pow(u[k], p[k]);
+  }
+#endif
+
+  /// Compute n Philox4x32-10 blocks in place. Block i has counter
+  /// (x0[i], x1[i], x2[i], x3[i]) and key (k0[i], k1[i]); the 32-bit
+  /// words are held in 64-bit integers, so that the products need no
+  /// widening.
+  SIMD_CLONES
+  void philoxN(int n, uint64_t* x0, uint64_t* x1, uint64_t* x2, 
+	       uint64_t* x3, const uint64_t* k0, const uint64_t* k1)
+  {
+    const uint64_t MASK=0xffffffffULL;
+    int i = 0;
+#if defined(__GNUC__)
+    typedef unsigned long long vuint __attribute__((vector_size(64)));
+    for(; i + VSIZE <= n; i += VSIZE)
+      {
+	vuint c0, c1, c2, c3, key0, key1;
+	memcpy(&c0, x0 + i, sizeof(c0));
+	memcpy(&c1, x1 + i, sizeof(c1));
+	memcpy(&c2, x2 + i, sizeof(c2));
+	memcpy(&c3, x3 + i, sizeof(c3));
+	memcpy(&key0, k0 + i, sizeof(key0));
+	memcpy(&key1, k1 + i, sizeof(key1));
+	for(int round=0; round < 10; round++)
+	  {
+	    vuint p0 = (c0 & MASK) * (uint64_t)M0;
+	    vuint p1 = (c2 & MASK) * (uint64_t)M1;
+	    c0 = (p1 >> 32) ^ c1 ^ key0;
+	    c1 = p1 & MASK;
+	    c2 = (p0 >> 32) ^ c3 ^ key1;
+	    c3 = p0 & MASK;
+	    key0 = (key0 + W0) & MASK;
+	    key1 = (key1 + W1) & MASK;
+	  }
+	memcpy(x0 + i, &c0, sizeof(c0));
+	memcpy(x1 + i, &c1, sizeof(c1));
+	memcpy(x2 + i, &c2, sizeof(c2));
+	memcpy(x3 + i, &c3, sizeof(c3));
+      }
+#endif
+    for(; i < n; i++)
+      {
+	uint32_t counter[4] = {(uint32_t)x0[i], (uint32_t)x1[i],
+			       (uint32_t)x2[i], (uint32_t)x3[i]};
+	uint32_t key[2] = {(uint32_t)k0[i], (uint32_t)k1[i]};
+	uint32_t block[4];
+	CounterRNG::philox(counter, key, block);
+	x0[i] = block[0];
+	x1[i] = block[1];
+	x2[i] = block[2];
+	x3[i] = block[3];
+      }
+  }
+};
+
+CounterRNG::CounterRNG(uint64_t seed, uint64_t stream)
+  : _seed(seed),
+    _stream(stream),
+    _counter(0),
+    _index(0),
+    _size(0),
+    _hasgaus(false),
+    _gaus(0)
+{
+}
+
+void CounterRNG::setSeed(uint64_t seed)
+{
+  _seed = seed;
+  setStream(_stream);
+}
+
+void CounterRNG::setStream(uint64_t stream)
+{
+  _stream  = stream;
+  _counter = 0;
+  _index   = 0;
+  _size    = 0;
+  _hasgaus = false;
+}
+
+void CounterRNG::philox(const uint32_t counter[4], const uint32_t key[2],
+			uint32_t block[4])
+{
+  uint32_t c0 = counter[0], c1 = counter[1];
+  uint32_t c2 = counter[2], c3 = counter[3];
+  uint32_t k0 = key[0], k1 = key[1];
+  for(int round=0; round < 10; round++)
+    {
+      uint32_t hi0, lo0, hi1, lo1;
+      mulhilo(M0, c0, hi0, lo0);
+      mulhilo(M1, c2, hi1, lo1);
+      c0 = hi1 ^ c1 ^ k0;
+      c1 = lo1;
+      c2 = hi0 ^ c3 ^ k1;
+      c3 = lo0;
+      k0 += W0;
+      k1 += W1;
+    }
+  block[0] = c0;
+  block[1] = c1;
+  block[2] = c2;
+  block[3] = c3;
+}
+
+void CounterRNG::_refill()
+{
+  uint32_t key[2] = {(uint32_t)_seed, (uint32_t)(_seed >> 32)};
+  for(int j=0; j < NBLOCKS; j++, _counter++)
+    {
+      uint32_t counter[4] = {(uint32_t)_counter, (uint32_t)(_counter >> 32),
+			     (uint32_t)_stream,  (uint32_t)(_stream >> 32)};
+      philox(counter, key, &_buffer[4*j]);
+    }
+  _index = 0;
+  _size  = BUFFERSIZE;
+}
+
+void CounterRNG::fill(int n, CounterRNG* rng)
+{
+  // list the blocks needed to fill the buffers, keeping the numbers
+  // not yet used at the front of each buffer
+  vector<uint64_t>& x0 = BLOCKS.x0;
+  vector<uint64_t>& x1 = BLOCKS.x1;
+  vector<uint64_t>& x2 = BLOCKS.x2;
+  vector<uint64_t>& x3 = BLOCKS.x3;
+  vector<uint64_t>& k0 = BLOCKS.k0;
+  vector<uint64_t>& k1 = BLOCKS.k1;
+  vector<uint32_t*>& dest = BLOCKS.dest;
+  x0.clear(); x1.clear(); x2.clear(); x3.clear(); k0.clear(); k1.clear();
+  dest.clear();
+  for(int t=0; t < n; t++)
+    {
+      CounterRNG& r = rng[t];
+      int unused = r._size - r._index;
+      int nblocks = (BUFFERSIZE - unused) / 4;
+      if ( nblocks == 0 ) continue;
+      memmove(r._buffer, r._buffer + r._index, unused * sizeof(uint32_t));
+      for(int j=0; j < nblocks; j++, r._counter++)
+	{
+	  x0.push_back((uint32_t)r._counter);
+	  x1.push_back((uint32_t)(r._counter >> 32));
+	  x2.push_back((uint32_t)r._stream);
+	  x3.push_back((uint32_t)(r._stream >> 32));
+	  k0.push_back((uint32_t)r._seed);
+	  k1.push_back((uint32_t)(r._seed >> 32));
+	  dest.push_back(r._buffer + unused + 4*j);
+	}
+      r._index = 0;
+      r._size  = unused + 4*nblocks;
+    }
+
+  int m = (int)dest.size();
+  if ( m == 0 ) return;
+  philoxN(m, &x0[0], &x1[0], &x2[0], &x3[0], &k0[0], &k1[0]);
+  for(int i=0; i < m; i++)
+    {
+      dest[i][0] = (uint32_t)x0[i];
+      dest[i][1] = (uint32_t)x1[i];
+      dest[i][2] = (uint32_t)x2[i];
+      dest[i][3] = (uint32_t)x3[i];
+    }
+}
+
+void CounterRNG::gamma(int n, CounterRNG* rng, 
+		       const double* shape, const double* scale, double* x)
+{
+  int m = padded(n);
+  Trials& w = TRIALS;
+  w.resize(m);
+
+  // draw the numbers for the first trial of each generator, and make
+  // the trials together. For a shape a < 1, a variate of shape a + 1
+  // is drawn, then multiplied by U^(1/a).
+  fill(n, rng);
+  bool boost = false;
+  for(int t=0; t < m; t++)
+    {
+      double a = t < n && shape[t] > 0 ? shape[t] : 1;
+      if ( a < 1 ) 
+	{
+	  a += 1;
+	  boost = true;
+	}
+      w.d[t] = a - 1.0 / 3;
+      w.c[t] = 1 / sqrt(9 * w.d[t]);
+      w.u1[t] = w.u2[t] = w.u3[t] = 0.5;
+      w.z[t] = 0;
+      if ( t >= n || ! (shape[t] > 0) ) continue;
+      
+      CounterRNG& r = rng[t];
+      if ( r._hasgaus )
+	{
+	  w.z[t]  = r._gaus;
+	  w.u1[t] = 0;
+	  r._hasgaus = false;
+	}
+      else
+	{
+	  w.u1[t] = r.uniform();
+	  w.u2[t] = r.uniform();
+	}
+      w.u3[t] = r.uniform();
+    }
+  gammaTrials(m, &w.d[0], &w.c[0], &w.z[0], &w.u1[0], &w.u2[0], &w.u3[0]);
+
+  // keep the second Box-Muller variates, and continue the rejected
+  // trials one generator at a time
+  for(int t=0; t < n; t++)
+    {
+      if ( ! (shape[t] > 0) )
+	{
+	  x[t] = 0;
+	  continue;
+	}
+      CounterRNG& r = rng[t];
+      if ( w.u1[t] > 0 )
+	{
+	  r._gaus = w.u2[t];
+	  r._hasgaus = true;
+	}
+      x[t] = w.u3[t] >= 0 ? w.u3[t] : r._gammaLoop(w.d[t], w.c[t]);
+      x[t] *= scale[t];
+    }
+  if ( ! boost ) return;
+
+  fill(n, rng);
+  for(int t=0; t < m; t++)
+    {
+      w.u1[t] = 1;
+      w.d[t]  = 1;
+      if ( t >= n || ! (shape[t] > 0 && shape[t] < 1) ) continue;
+      w.u1[t] = rng[t].uniform();
+      w.d[t]  = 1 / shape[t];
+    }
+  powers(m, &w.u1[0], &w.d[0]);
+  for(int t=0; t < n; t++) x[t] *= w.u1[t];
+}
+
+void CounterRNG::poisson(int n, CounterRNG* rng, 
+			 const double* mean, double* k)
+{
+  int m = padded(n);
+  Trials& w = TRIALS;
+  w.resize(m);
+
+  // draw the numbers for the first trial of each generator with a
+  // large mean, and make the trials together
+  fill(n, rng);
+  for(int t=0; t < m; t++)
+    {
+      w.d[t]  = t < n && mean[t] > 0 ? mean[t] : 1;
+      w.u1[t] = 0.25;
+      w.u2[t] = 0.5;
+      if ( t >= n || ! (mean[t] >= POISSONSWITCH) ) continue;
+      w.u1[t] = rng[t].uniform() - 0.5;
+      w.u2[t] = rng[t].uniform();
+    }
+  poissonTrials(m, &w.d[0], &w.u1[0], &w.u2[0], &w.u3[0]);
+
+  for(int t=0; t < n; t++)
+    {
+      CounterRNG& r = rng[t];
+      if ( ! (mean[t] > 0) )
+	k[t] = 0;
+      else if ( mean[t] < POISSONSWITCH )
+	{
+	  // invert the distribution function, which needs one uniform
+	  // variate; the sum of the probabilities can round to below u
+	  // when u is close to 1, hence the cutoff
+	  double u = r.uniform();
+	  double p = w.u3[t];
+	  double F = p;
+	  double count = 0;
+	  while ( u > F && count < POISSONCUTOFF )
+	    {
+	      count++;
+	      p *= mean[t] / count;
+	      F += p;
+	    }
+	  k[t] = count;
+	}
+      else
+	k[t] = w.u3[t] >= 0 ? w.u3[t] : r._ptrsLoop(mean[t], w.u1[t], w.u2[t]);
+    }
+}
+
+int CounterRNG::integer(int n)
+{
+  int k = (int)(uniform() * n);
+  return k < n ? k : n - 1;
+}
+
+double CounterRNG::gaus()
+{
+  // Box-Muller; the second variate is kept for the next call
+  if ( _hasgaus )
+    {
+      _hasgaus = false;
+      return _gaus;
+    }
+  double r   = sqrt(-2 * log(uniform()));
+  double phi = 2 * M_PI * uniform();
+  _gaus    = r * sin(phi);
+  _hasgaus = true;
+  return r * cos(phi);
+}
+
+double CounterRNG::gamma(double shape, double scale)
+{
+  double x;
+  gamma(1, this, &shape, &scale, &x);
+  return x;
+}
+
+double CounterRNG::poisson(double mean)
+{
+  double k;
+  poisson(1, this, &mean, &k);
+  return k;
+}
+
+double CounterRNG::_gammaLoop(double d, double c)
+{
+  // G. Marsaglia and W. Tsang, ACM TOMS 26 (2000) 363
+  while ( true )
+    {
+      double x, v;
+      do
+	{
+	  x = gaus();
+	  v = 1 + c * x;
+	}
+      while ( v <= 0 );
+      v = v * v * v;
+      double u  = uniform();
+      double x2 = x * x;
+      if ( u < 1 - 0.0331 * x2 * x2 ) return d * v;
+      if ( log(u) < 0.5 * x2 + d * (1 - v + log(v)) ) return d * v;
+    }
+}
+
+double CounterRNG::_ptrsLoop(double mean, double u, double v)
+{
+  // transformed rejection with squeeze (PTRS), W. Hormann,
+  // Insurance: Mathematics and Economics 12 (1993) 39, starting with 
+  // the trial (u, v)
+  double slam   = sqrt(mean);
+  double loglam = log(mean);
+  double b = 0.931 + 2.53 * slam;
+  double a = -0.059 + 0.02483 * b;
+  double invalpha = 1.1239 + 1.1328 / (b - 3.4);
+  double vr = 0.9277 - 3.6224 / (b - 2);
+  while ( true )
+    {
+      double us = 0.5 - fabs(u);
+      double k  = floor((2 * a / us + b) * u + mean + 0.43);
+      if ( us >= 0.07 && v <= vr ) return k;
+      if ( k >= 0 && (us >= 0.013 || v <= us) &&
+	   log(v) + log(invalpha) - log(a / (us * us) + b) <=
+	   -mean + k * loglam - lgamma(k + 1) )
+	return k;
+      u = uniform() - 0.5;
+      v = uniform();
+    }
+}
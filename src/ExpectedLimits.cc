@@ -12,19 +12,126 @@
 #include <cmath>
 #include <algorithm>
 #include <stdlib.h>
+#include <mutex>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include "TMath.h"
+#include "TError.h"
 #include "ExpectedLimits.h"
+#include "ThreadPool.h"
+#include "StreamingQuantiles.h"
 
 using namespace std;
+
+namespace {
+  const char MAGIC[8] = {'L','I','M','S','H','A','R','D'};
+  const uint32_t VERSION=1;
+  const uint32_t ENDIAN=0x01020304;
+
+  // number of toys a worker generates at a time
+  const int BATCHSIZE=64;
+
+  // The calculation for a toy may start from the results for the 
+  // previous toy (e.g., Bayes::setWarmStart). So that the limits do
+  // not depend on how the toys are shared among threads, the toys are
+  // shared in chains of CHAINSIZE, aligned to the toy index, and the
+  // calculator is reset at the start of each chain.
+  const int CHAINSIZE=16;
+
+  // header of a shard checkpoint file, which is followed by a
+  // (limit, estimate) pair for each toy completed
+  struct ShardHeader
+  {
+    char     magic[8];
+    uint32_t version;
+    uint32_t endian;               // ENDIAN in the writer's byte order
+    int32_t  shard;
+    int32_t  nshards;
+    int32_t  seed;
+    int32_t  ensemblesize;
+    int32_t  estimates;            // 1 if the estimates were computed
+    int32_t  ntoys;                // number of toys completed
+    double   truevalue;
+  };
+
+  // read a checkpoint file; return false if it does not exist
+  bool readShard(string filename, ShardHeader& header,
+		 vector<double>& records)
+  {
+    ifstream inp(filename.c_str(), ios::binary);
+    if ( ! inp.good() ) return false;
+    if ( ! inp.read((char*)&header, sizeof(header)) ||
+	 memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+	 header.endian != ENDIAN )
+      {
+	Error("ExpectedLimits", 
+	      "%s is not a shard file for this machine", filename.c_str());
+	exit(0);
+      }
+    if ( header.version != VERSION )
+      {
+	Error("ExpectedLimits", "%s has version %d; expected version %d",
+	      filename.c_str(), (int)header.version, (int)VERSION);
+	exit(0);
+      }
+    if ( header.nshards <= 0 || 
+	 header.shard < 0 || header.shard >= header.nshards ||
+	 header.ensemblesize < 0 ||
+	 header.ntoys < 0 || header.ntoys > header.ensemblesize )
+      {
+	Error("ExpectedLimits", "%s has an invalid header", 
+	      filename.c_str());
+	exit(0);
+      }
+    records.resize(2 * (size_t)header.ntoys);
+    if ( records.size() > 0 &&
+	 ! inp.read((char*)&records[0], records.size() * sizeof(double)) )
+      {
+	Error("ExpectedLimits", "%s is truncated", filename.c_str());
+	exit(0);
+      }
+    return true;
+  }
+
+  // Write a checkpoint file. The file is written under a temporary 
+  // name and renamed, so that an interrupted write leaves the previous
+  // checkpoint intact.
+  void writeShard(string filename, ShardHeader& header,
+		  vector<double>& records)
+  {
+    header.ntoys = records.size() / 2;
+    string tmpname = filename + ".tmp";
+    ofstream out(tmpname.c_str(), ios::binary);
+    out.write((const char*)&header, sizeof(header));
+    if ( records.size() > 0 )
+      out.write((const char*)&records[0], records.size() * sizeof(double));
+    out.close();
+    if ( ! out.good() || rename(tmpname.c_str(), filename.c_str()) != 0 )
+      {
+	Error("ExpectedLimits", "error writing file %s", filename.c_str());
+	exit(0);
+      }
+  }
+};
 // ---------------------------------------------------------------------------
 vector<double> ExpectedLimits::dummy;
 
 ExpectedLimits::ExpectedLimits()
   : _calculator(0),
     _ensemblesize(0),
+    _seed(12345),
     _prob(dummy),
     _rms(0),
     _bias(0),    
-    _debuglevel(0)
+    _debuglevel(0),
+    _asimov(false),
+    _tolerance(0),
+    _ntoys(0),
+    _shard(0),
+    _nshards(0),
+    _checkpoint("")
 {}
 
 
@@ -34,11 +141,17 @@ ExpectedLimits::ExpectedLimits(LimitCalculator& calculator,
 			       
   : _calculator(&calculator),
     _ensemblesize(ensemblesize),
+    _seed(12345),
     _prob(prob_),
-    _limit(vector<double>(ensemblesize)),
     _rms(0),
     _bias(0),
-    _debuglevel(0)
+    _debuglevel(0),
+    _asimov(false),
+    _tolerance(0),
+    _ntoys(0),
+    _shard(0),
+    _nshards(0),
+    _checkpoint("")
 {
   if ( getenv("DBExpectedLimits") != (char*)0 )
     _debuglevel = atoi(getenv("DBExpectedLimits"));
@@ -63,73 +176,414 @@ ExpectedLimits::~ExpectedLimits()
 vector<double>
 ExpectedLimits::operator()(double true_value, bool compute_rms)
 {
-  char record[80];
+  if ( _asimov ) return _asimovLimits(true_value);
+  
   int step = _ensemblesize / 4;
+  if ( step < 1 ) step = 1;
   _rms  = 0;
   _bias = 0;
-  for(int c=0; c < _ensemblesize; c++)
+  _ntoys = 0;
+
+  // a shard generates a contiguous range of the toys of the ensemble
+  bool sharded = _nshards > 0;
+  int firsttoy = 0;
+  int lasttoy  = _ensemblesize;
+  if ( sharded )
     {
-      if ( c % step == 0 ) cout << "\tgenerating sample:\t" << c;
-      
-      // generate a data set assuming the background only hypothesis
-      // that is, mu=0
-      vector<double>& d = _calculator->pdf()->generate(true_value);
-      if ( _debuglevel > 2 )
+      firsttoy = (long)_ensemblesize * _shard / _nshards;
+      lasttoy  = (long)_ensemblesize * (_shard + 1) / _nshards;
+    }
+  int ensemblesize = lasttoy - firsttoy;
+
+  // resume from the checkpoint of an interrupted shard
+  ShardHeader header;
+  vector<double> records;
+  if ( sharded )
+    {
+      ShardHeader expected;
+      memset(&expected, 0, sizeof(expected));
+      memcpy(expected.magic, MAGIC, sizeof(MAGIC));
+      expected.version      = VERSION;
+      expected.endian       = ENDIAN;
+      expected.shard        = _shard;
+      expected.nshards      = _nshards;
+      expected.seed         = _seed;
+      expected.ensemblesize = _ensemblesize;
+      expected.estimates    = compute_rms ? 1 : 0;
+      expected.truevalue    = true_value;
+      if ( readShard(_checkpoint, header, records) )
 	{
-	  cout << endl << c << "\tgenerated data: " << endl;
-	  for(size_t ii=0; ii < d.size(); ii++)
+	  if ( header.shard != expected.shard ||
+	       header.nshards != expected.nshards ||
+	       header.seed != expected.seed ||
+	       header.ensemblesize != expected.ensemblesize ||
+	       header.estimates != expected.estimates ||
+	       header.truevalue != expected.truevalue )
 	    {
-	      sprintf(record, " %9.0f", d[ii]);
-	      cout << record;
+	      Error("ExpectedLimits", 
+		    "%s was written by a different run", 
+		    _checkpoint.c_str());
+	      exit(0);
 	    }
-	  cout << endl;
+	  if ( _debuglevel > 0 )
+	    cout << "\tExpectedLimits: resume shard " << _shard
+		 << " after " << header.ntoys << " toys" << endl;
 	}
-      
-      // update data in calculator
-      _calculator->setData(d);
-      
-      // compute 95% limit
-      _limit[c] = _calculator->percentile();
+      header = expected;
+    }
 
+  // give each thread its own calculator. If the calculator cannot be
+  // cloned, run the ensemble serially using the original calculator
+  ThreadPool& pool = ThreadPool::instance();
+  int nworkers = max(1, min(pool.size(), ensemblesize));
+  vector<LimitCalculator*> calculators;
+  if ( nworkers > 1 )
+    for(int w=0; w < nworkers; w++)
+      {
+	LimitCalculator* calculator = _calculator->clone();
+	if ( calculator == 0 ) break;
+	calculators.push_back(calculator);
+      }
+  if ( (int)calculators.size() < nworkers )
+    {
+      for(size_t w=0; w < calculators.size(); w++) delete calculators[w];
+      calculators.clear();
+      nworkers = 1;
+    }
+
+  // every toy is generated from its own stream, so the toys do not 
+  // depend on which calculator generates them
+  if ( calculators.size() == 0 ) _calculator->pdf()->setSeed(_seed);
+  for(size_t w=0; w < calculators.size(); w++) 
+    calculators[w]->pdf()->setSeed(_seed);
+  if ( _debuglevel > 0 )
+    cout << "\tExpectedLimits: " << nworkers << " thread(s)" << endl;
+
+  // Without a tolerance, the whole ensemble is one round. Otherwise,
+  // it is generated in rounds, after each of which the uncertainties
+  // of the quantiles are checked. A shard is checkpointed after each 
+  // round. The rounds do not depend on the number of threads, so 
+  // neither does the toy at which the ensemble stops.
+  int roundsize = ensemblesize;
+  if ( sharded || _tolerance > 0 )
+    roundsize = min(ensemblesize, (int)ROUNDSIZE);
+  roundsize = max(roundsize, 1);
+
+  StreamingQuantiles quantiles(_prob);
+  vector<double> limits(roundsize);
+  vector<double> estimates(roundsize);
+  double sum = 0;
+  mutex outputlock;
+
+  // include the toys of the checkpoint
+  for(size_t c=0; c < records.size() / 2; c++)
+    {
+      quantiles.add(records[2*c]);
       if ( compute_rms )
 	{
-	  double estimate = _calculator->estimate();
-	  double de = estimate - true_value;
-	  _rms  += de*de;
-	  _bias += estimate;
+	  double de = records[2*c+1] - true_value;
+	  _rms += de*de;
+	  sum  += records[2*c+1];
 	}
-      if ( c % step == 0 )
+    }
+  _ntoys = records.size() / 2;
+  
+  while ( _ntoys < ensemblesize )
+    {
+      int first = firsttoy + _ntoys;
+      int ntoys = min(roundsize, ensemblesize - _ntoys);
+
+      // starts of the chains of this round, each worker taking a
+      // contiguous block of chains
+      vector<int> chains;
+      for(int t=0; t < ntoys; t++)
+	if ( t == 0 || (first + t) % CHAINSIZE == 0 ) chains.push_back(t);
+      int nchains = (int)chains.size();
+      chains.push_back(ntoys);
+      int blocksize = (nchains + nworkers - 1) / nworkers;
+      
+      pool.run(nworkers, [&](int w)
+	       {
+		 LimitCalculator* calculator = _calculator;
+		 if ( calculators.size() > 0 ) calculator = calculators[w];
+		 
+		 int begin = chains[min(w * blocksize, nchains)];
+		 int end   = chains[min((w + 1) * blocksize, nchains)];
+		 vector<double> batch;
+		 vector<double> d;
+		 int nbins = 0;
+		 for(int t=begin; t < end; t++)
+		   {
+		     int c = first + t;
+		     if ( c % step == 0 )
+		       {
+			 lock_guard<mutex> lock(outputlock);
+			 cout << "\tgenerating sample:\t" << c << endl;
+		       }
+		     
+		     // generate the data sets a batch at a time
+		     int b = (t - begin) % BATCHSIZE;
+		     if ( b == 0 )
+		       {
+			 int nb = min((int)BATCHSIZE, end - t);
+			 calculator->pdf()->generateBatch(true_value, nb, 
+							  batch, c);
+			 nbins = (int)batch.size() / nb;
+		       }
+		     d.assign(batch.begin() + b*nbins, 
+			      batch.begin() + (b+1)*nbins);
+		     if ( _debuglevel > 2 )
+		       {
+			 lock_guard<mutex> lock(outputlock);
+			 char record[80];
+			 cout << endl << c << "\tgenerated data: " << endl;
+			 for(size_t ii=0; ii < d.size(); ii++)
+			   {
+			     sprintf(record, " %9.0f", d[ii]);
+			     cout << record;
+			   }
+			 cout << endl;
+		       }
+		     
+		     // update data in calculator
+		     if ( t == begin || c % CHAINSIZE == 0 ) 
+		       calculator->reset();
+		     calculator->setData(d);
+		     
+		     // compute 95% limit
+		     limits[t] = calculator->percentile();
+		     
+		     estimates[t] = compute_rms ? calculator->estimate() : 0;
+		   }
+	       });
+
+      // add the limits in the order of the toys, so that the
+      // quantiles do not depend on how the threads are scheduled
+      for(int t=0; t < ntoys; t++)
 	{
+	  quantiles.add(limits[t]);
 	  if ( compute_rms )
 	    {
-	      if ( c > 0 )
-		cout << "\trms = " << sqrt(_rms / c) << endl;
-	      else
-		cout << endl;
+	      double de = estimates[t] - true_value;
+	      _rms += de*de;
+	      sum  += estimates[t];
 	    }
-	  else
-	    cout << endl;
+	  if ( sharded )
+	    {
+	      records.push_back(limits[t]);
+	      records.push_back(estimates[t]);
+	    }
+	}
+      _ntoys += ntoys;
+      if ( sharded ) writeShard(_checkpoint, header, records);
+
+      if ( ! sharded && _tolerance > 0 && _ntoys < ensemblesize )
+	{
+	  _errors = quantiles.errors();
+	  double maxerror = *max_element(_errors.begin(), _errors.end());
+	  if ( _debuglevel > 0 )
+	    cout << "\tExpectedLimits: " << _ntoys 
+		 << " toys, largest uncertainty = " << maxerror << endl;
+	  if ( maxerror < _tolerance ) break;
 	}
     }
+  _errors = quantiles.errors();
+  if ( sharded && records.size() == 0 ) 
+    writeShard(_checkpoint, header, records);
+  
+  for(size_t w=0; w < calculators.size(); w++) delete calculators[w];
+  
+  if ( compute_rms && _ntoys > 0 )
+    {
+      _rms  = sqrt(_rms / _ntoys);
+      _bias = sum / _ntoys - true_value;
+      cout << "\trms = " << _rms << endl;
+    }
+  return quantiles.quantiles();
+}
 
-  if ( compute_rms )
+void
+ExpectedLimits::setShard(int shard, int nshards, string checkpoint)
+{
+  if ( nshards < 0 || (nshards > 0 && (shard < 0 || shard >= nshards)) )
+    {
+      Error("ExpectedLimits", "invalid shard %d of %d shards", 
+	    shard, nshards);
+      exit(0);
+    }
+  if ( nshards > 0 )
     {
-      _rms  = sqrt(_rms / _ensemblesize);
-      _bias = _bias / _ensemblesize - true_value;
+      // the checkpoint is written under a temporary name and renamed
+      // (see writeShard), so check that the temporary file can be
+      // written now rather than after the first round of toys
+      string tmpname = checkpoint + ".tmp";
+      ofstream out(tmpname.c_str(), ios::binary | ios::app);
+      bool writable = checkpoint != "" && out.good();
+      out.close();
+      if ( writable ) remove(tmpname.c_str());
+      if ( ! writable )
+	{
+	  Error("ExpectedLimits", "unable to write checkpoint file %s",
+		checkpoint.c_str());
+	  exit(0);
+	}
     }
-		
-  // now sort limits in increasing order
-  sort(_limit.begin(), _limit.end());
+  _shard = shard;
+  _nshards = nshards;
+  _checkpoint = checkpoint;
+}
 
-  // get percentiles
-  vector<double> percentiles(_prob.size());
-  for(size_t ii=0; ii < _prob.size(); ii++)
+vector<double>
+ExpectedLimits::merge(const vector<string>& filenames)
+{
+  _rms  = 0;
+  _bias = 0;
+  _ntoys = 0;
+
+  // read the shards, and order them by shard index
+  vector<ShardHeader> headers(filenames.size());
+  vector<vector<double> > records(filenames.size());
+  vector<pair<int, int> > order;
+  for(size_t f=0; f < filenames.size(); f++)
+    {
+      if ( ! readShard(filenames[f], headers[f], records[f]) )
+	{
+	  Error("ExpectedLimits", "unable to open file %s", 
+		filenames[f].c_str());
+	  exit(0);
+	}
+      const ShardHeader& h = headers[f];
+      const ShardHeader& h0 = headers[0];
+      if ( h.nshards != h0.nshards || 
+	   h.seed != h0.seed ||
+	   h.ensemblesize != h0.ensemblesize ||
+	   h.estimates != h0.estimates ||
+	   h.truevalue != h0.truevalue )
+	{
+	  Error("ExpectedLimits", "%s and %s are from different runs",
+		filenames[0].c_str(), filenames[f].c_str());
+	  exit(0);
+	}
+      order.push_back(make_pair((int)h.shard, (int)f));
+    }
+  if ( order.size() == 0 )
+    {
+      Error("ExpectedLimits", "no shard files to merge");
+      exit(0);
+    }
+  sort(order.begin(), order.end());
+  for(size_t k=1; k < order.size(); k++)
+    if ( order[k].first == order[k-1].first )
+      {
+	Error("ExpectedLimits", "%s and %s are the same shard",
+	      filenames[order[k-1].second].c_str(), 
+	      filenames[order[k].second].c_str());
+	exit(0);
+      }
+  // the shard indices are distinct and less than nshards, so a shard
+  // is missing if there are fewer of them
+  for(int k=0; k < headers[0].nshards; k++)
+    if ( k >= (int)order.size() || order[k].first != k )
+      {
+	Error("ExpectedLimits", "shard %d of %d is missing",
+	      k, (int)headers[0].nshards);
+	exit(0);
+      }
+
+  StreamingQuantiles quantiles(_prob);
+  double sum = 0;
+  double true_value = 0;
+  bool compute_rms = false;
+  for(size_t k=0; k < order.size(); k++)
+    {
+      const ShardHeader& h = headers[order[k].second];
+      const vector<double>& r = records[order[k].second];
+      true_value  = h.truevalue;
+      compute_rms = h.estimates != 0;
+      
+      int expected = (long)h.ensemblesize * (h.shard + 1) / h.nshards -
+	(long)h.ensemblesize * h.shard / h.nshards;
+      if ( h.ntoys < expected )
+	Warning("ExpectedLimits", "shard %d is incomplete: %d of %d toys",
+		(int)h.shard, (int)h.ntoys, expected);
+
+      for(int c=0; c < h.ntoys; c++)
+	{
+	  quantiles.add(r[2*c]);
+	  if ( compute_rms )
+	    {
+	      double de = r[2*c+1] - true_value;
+	      _rms += de*de;
+	      sum  += r[2*c+1];
+	    }
+	}
+      _ntoys += h.ntoys;
+    }
+  if ( compute_rms && _ntoys > 0 )
+    {
+      _rms  = sqrt(_rms / _ntoys);
+      _bias = sum / _ntoys - true_value;
+    }
+  _errors = quantiles.errors();
+  return quantiles.quantiles();
+}
+
+vector<double>
+ExpectedLimits::_asimovLimits(double true_value)
+{
+  // work on a copy so that the data of the caller's calculator are
+  // left untouched
+  LimitCalculator* calculator = _calculator->clone();
+  if ( calculator == 0 )
     {
-      // compute ordinal value of percentile
-      double q = _prob[ii] * _ensemblesize;
-      int    i = (int)q;
-      double x = q - i;
-      percentiles[ii] = x * _limit[i+1] + (1 - x) * _limit[i]; 
+      Warning("ExpectedLimits", 
+	      "the calculator cannot be cloned; its data will be replaced "
+	      "by the Asimov dataset");
+      calculator = _calculator;
     }
+  PDFunction* model = calculator->pdf();
+  vector<double> data = model->asimov(true_value);
+  if ( data.size() == 0 )
+    {
+      Error("ExpectedLimits", 
+	    "the model does not provide an Asimov dataset");
+      exit(0);
+    }
+  if ( _debuglevel > 2 )
+    {
+      char record[80];
+      cout << endl << "\tAsimov data: " << endl;
+      for(size_t ii=0; ii < data.size(); ii++)
+	{
+	  sprintf(record, " %9.2f", data[ii]);
+	  cout << record;
+	}
+      cout << endl;
+    }
+  
+  // the limit for the Asimov dataset is the median limit, and the
+  // spread of the limits follows from the likelihood ratio there
+  calculator->setData(data);
+  double median = calculator->percentile();
+  double muhat  = calculator->estimate();
+  double qA = 2 * (model->logLikelihood(data, muhat) - 
+		   model->logLikelihood(data, median));
+  if ( calculator != _calculator ) delete calculator;
+  double sigma = qA > 0 ? fabs(median - muhat) / sqrt(qA) : 0;
+  _rms  = sigma;
+  _bias = muhat - true_value;
+  _ntoys  = 0;
+  _errors = vector<double>(_prob.size(), 0);
+  if ( _debuglevel > 0 )
+    cout << "\tExpectedLimits: Asimov median = " << median 
+	 << " estimate = " << muhat << " sigma = " << sigma << endl;
+  
+  // Averaging over a swarm can shift the estimate for the Asimov
+  // dataset away from the true value, so the limits are placed 
+  // relative to the true value rather than to the estimate
+  vector<double> percentiles(_prob.size());
+  for(size_t ii=0; ii < _prob.size(); ii++)
+    percentiles[ii] = true_value + (median - muhat) + 
+      sigma * TMath::NormQuantile(_prob[ii]);
   return percentiles;
 }
@@ -12,31 +12,95 @@
 #include <sstream>
 #include <cmath>
 #include <map>
+#include <cstring>
 #include "TMath.h"
 #include "MultiPoisson.h"
+#include "SwarmFile.h"
+#include "SwarmReader.h"
+#include "VectorMath.h"
 #include "TError.h"
 
 using namespace std;
 
 namespace {
-  ///
-  std::string strip(std::string line)
+#if defined(__GNUC__)
+  using namespace VectorMath;
+#endif
+
+  /// lnp[k] += n * log(mu * s[k] + b[k]), k = 0,..., npoints-1
+  SIMD_CLONES
+  void addLogMean(int npoints, double n, double mu,
+		  const double* s, const double* b, double* lnp)
+  {
+    int k = 0;
+#if defined(__GNUC__)
+    for(; k + VSIZE <= npoints; k += VSIZE)
+      {
+	vdouble vs, vb, vl;
+	memcpy(&vs, s + k, sizeof(vs));
+	memcpy(&vb, b + k, sizeof(vb));
+	memcpy(&vl, lnp + k, sizeof(vl));
+	vdouble mean = mu * vs + vb;
+	vlog(mean);
+	vl += n * mean;
+	memcpy(lnp + k, &vl, sizeof(vl));
+      }
+#endif
+    for(; k < npoints; ++k)
+      {
+	double mean = mu * s[k] + b[k];
+	lnp[k] += n * (mean > 0 ? log(mean) : -HUGE_VAL);
+      }
+  }
+
+  /// g[k] += n * r, h[k] -= n * r^2, r = s[k] / (mu * s[k] + b[k])
+  SIMD_CLONES
+  void addDerivatives(int npoints, double n, double mu,
+		      const double* s, const double* b, double* g, double* h)
+  {
+    for(int k=0; k < npoints; ++k)
+      {
+	double r = s[k] / (mu * s[k] + b[k]);
+	g[k] += n * r;
+	h[k] -= n * r * r;
+      }
+  }
+
+  /// Return the index of the largest of x[k], k = 0,..., npoints-1
+  SIMD_CLONES
+  int argmax(int npoints, const double* x)
   {
-    int l = line.size();
-    if ( l == 0 ) return std::string("");
-    int n = 0;
-    while (((line[n] == 0)    ||
-	    (line[n] == ' ' ) ||
-	    (line[n] == '\n') ||
-	    (line[n] == '\t')) && n < l) n++;
-    
-    int m = l-1;
-    while (((line[m] == 0)    ||
-	    (line[m] == ' ')  ||
-	    (line[m] == '\n') ||
-	    (line[m] == '\t')) && m > 0) m--;
-    return line.substr(n,m-n+1);
+    double xmax = -HUGE_VAL;
+    int k = 0;
+#if defined(__GNUC__)
+    if ( npoints >= VSIZE )
+      {
+	vdouble vmax;
+	memcpy(&vmax, x, sizeof(vmax));
+	for(k=VSIZE; k + VSIZE <= npoints; k += VSIZE)
+	  {
+	    vdouble v;
+	    memcpy(&v, x + k, sizeof(v));
+	    vmax = vmax > v ? vmax : v;
+	  }
+	for(int i=0; i < VSIZE; i++) xmax = max(xmax, vmax[i]);
+      }
+#endif
+    for(; k < npoints; ++k) xmax = max(xmax, x[k]);
+    for(k=0; k < npoints; ++k) if ( x[k] == xmax ) return k;
+    return 0;
   }
+
+  // workspace for the profile likelihood, one per thread
+  thread_local vector<int> CANDIDATES;
+
+  // workspace for the averaged likelihood, one per thread, so that
+  // logLikelihood does not allocate on every call
+  struct Workspace
+  {
+    vector<double> poi, lnL, lnp, lnmax, sum;
+  };
+  thread_local Workspace WORKSPACE;
 };
 
 
@@ -44,14 +108,23 @@ MultiPoisson::MultiPoisson()
   : PDFunction(),
     _N(vector<double>()),
     _Ngen(vector<double>()),
-    _S(vector<vector<double> >()),
-    _B(vector<vector<double> >()),
+    _S(vector<double>()),
+    _B(vector<double>()),
+    _sumS(vector<double>()),
+    _sumB(vector<double>()),
     _meanS(vector<double>()),
     _meanB(vector<double>()),    
-    _random(TRandom3()),
+    _random(CounterRNG()),
     _nbins(0),
+    _npoints(0),
+    _stride(0),
     _index(-1),
-    _profile(false)
+    _profile(false),
+    _pS(0),
+    _pB(0),
+    _psumS(0),
+    _psumB(0),
+    _argmax(0)
 {}
 
 
@@ -59,56 +132,78 @@ MultiPoisson::MultiPoisson(string filename)
   : PDFunction(),
     _N(vector<double>()),
     _Ngen(vector<double>()),
-    _S(vector<vector<double> >()),
-    _B(vector<vector<double> >()),
+    _S(vector<double>()),
+    _B(vector<double>()),
+    _sumS(vector<double>()),
+    _sumB(vector<double>()),
     _meanS(vector<double>()),
     _meanB(vector<double>()),    
-    _random(TRandom3()),
+    _random(CounterRNG()),
     _nbins(0),
+    _npoints(0),
+    _stride(0),
     _index(-1),
-    _profile(false) 
+    _profile(false),
+    _pS(0),
+    _pB(0),
+    _psumS(0),
+    _psumB(0),
+    _argmax(0)
+{
+  if ( SwarmFile::isBinary(filename) )
+    {
+      _readBinary(filename);
+      return;
+    }
+  
+  SwarmReader reader(filename);
+  _readText(reader, -1);
+}
+
+MultiPoisson::MultiPoisson(SwarmReader& reader, int npoints)
+  : PDFunction(),
+    _N(vector<double>()),
+    _Ngen(vector<double>()),
+    _S(vector<double>()),
+    _B(vector<double>()),
+    _sumS(vector<double>()),
+    _sumB(vector<double>()),
+    _meanS(vector<double>()),
+    _meanB(vector<double>()),    
+    _random(CounterRNG()),
+    _nbins(0),
+    _npoints(0),
+    _stride(0),
+    _index(-1),
+    _profile(false),
+    _pS(0),
+    _pB(0),
+    _psumS(0),
+    _psumB(0),
+    _argmax(0)
+{
+  _readText(reader, npoints);
+}
+
+void MultiPoisson::_readText(SwarmReader& reader, int npoints)
 {
-  // open input text file with format
+  // text file format
   // number of bins  ... 
   // count1 count2 ...
   // number of points
   // S1   S2   ...
   // B1   B2   ...
-  
-  ifstream inp(filename.c_str());
-  if ( ! inp.good() )
-    {
-      Error("MultiPoisson", "unable to open file %s", filename.c_str());
-      exit(0);
-    }
-  
-  // read lines
-  vector<string> records;
-  string line;
-  while(getline(inp, line))
-    {
-      line = strip(line);
-      if (line == "") continue;
-      if (line.substr(0,1) == "#") continue;
-      records.push_back(line);
-    }
 
-  if (records.size() == 0)
+  // get number of bins
+  string record;
+  if ( ! reader.next(record) )
     {
       Error("MultiPoisson", "zero uncommented records in file %s",
-	    filename.c_str());
+	    reader.filename().c_str());
       exit(0);
     }
-  
-  // get number of bins
-  _nbins = 0;
-  int lineno = 0;
-  stringstream nin(records[lineno]);
-  try
-    {
-      nin >> _nbins;
-    }
-  catch (...)
+  _nbins = atoi(record.c_str());
+  if ( _nbins <= 0 )
     {
       Error("MultiPoisson",
 	    "unable to get number of bins; check file format");
@@ -116,128 +211,290 @@ MultiPoisson::MultiPoisson(string filename)
     }
 
   // get observed counts 
-  
-  vector<double> S;
-  vector<double> B;
-  lineno++;
-  stringstream din(records[lineno]);
-
-  int c = 0;
-  double x;
-  for(int i=0; i < _nbins; i++)
+  if ( reader.read(1, _nbins, _N) < 1 )
     {
-      try
-	{
-	  c++;
-	  din >> x;
-	}
-      catch (...)
-	{
-	  Error("MultiPoisson", "problem accessing observed count at bin %d",
-		c);
-	  exit(0);	  
-	}
-      _N.push_back(x);
-      _meanS.push_back(0);
-      _meanB.push_back(0);
-      S.push_back(0);
-      B.push_back(0);
+      Error("MultiPoisson", "observed counts not found in file %s",
+	    reader.filename().c_str());
+      exit(0);
     }
+  _Ngen = _N;
+  _meanS.assign(_nbins, 0);
+  _meanB.assign(_nbins, 0);
   
   // get number of samples
   int samplesize = 0;
-  lineno++;
-  stringstream hin(records[lineno]);
-  try
-    {
-      hin >> samplesize;
-    }
-  catch (...)
+  if ( reader.next(record) ) samplesize = atoi(record.c_str());
+  if ( samplesize <= 0 )
     {
       Error("MultiPoisson",
 	    "unable to get sample size; check file format");
       exit(0);
     }
+  if ( npoints < 0 || npoints > samplesize ) npoints = samplesize;
+
+  _reserve(samplesize);
+  read(reader, npoints);
+}
 
-  // loop over sampled points  
-  for(int ii=0; ii < samplesize; ii++)
+int MultiPoisson::read(SwarmReader& reader, int npoints)
+{
+  vector<double> S(_nbins);
+  vector<double> B(_nbins);
+  vector<double> values;
+  int count = 0;
+  while ( count < npoints )
     {
-      // get signals or effective luminosities
-      lineno++;
-      stringstream sin(records[lineno]);
-      try
+      // decode a chunk of points, each a line of signals 
+      // (or effective luminosities) followed by a line of backgrounds
+      int chunk = max(1, (int)SwarmReader::CHUNKSIZE / (2*_nbins));
+      chunk = min(npoints - count, chunk);
+      int nrecords = reader.read(2*chunk, _nbins, values);
+      if ( nrecords % 2 != 0 )
 	{
-	  for(int i=0; i < _nbins; i++) sin >> S[i];
-	}
-      catch (...)
-	{
-	  Error("MultiPoisson",
-		"problem decoding signal counts:\n%s",
-		records[lineno].c_str());
+	  Error("MultiPoisson", "backgrounds missing at end of file %s",
+		reader.filename().c_str());
 	  exit(0);
 	}
-
-      // get backgrounds
-      lineno++;
-      stringstream bin(records[lineno]);
-      try
+      int n = nrecords / 2;
+      for(int ii=0; ii < n; ii++)
 	{
-	  for(int i=0; i < _nbins; i++) bin >> B[i];
+	  const double* row = &values[2*ii*_nbins];
+	  copy(row, row + _nbins, S.begin());
+	  copy(row + _nbins, row + 2*_nbins, B.begin());
+	  add(S, B);
 	}
-      catch(...)
-	{
-	  Error("MultiPoisson",
-		"problem decoding background counts:\n%s",
-		records[lineno].c_str());
-	  exit(0);
-	}
-
-      add(S, B);
+      count += n;
+      if ( n < chunk ) break;
     }
-  computeMeans();
+  if ( _npoints > 0 ) computeMeans();
+  return count;
 }
 
 MultiPoisson::MultiPoisson(vector<double>& N)
   : PDFunction(),
     _N(N),
     _Ngen(N),
-    _S(vector<vector<double> >()),
-    _B(vector<vector<double> >()),
+    _S(vector<double>()),
+    _B(vector<double>()),
+    _sumS(vector<double>()),
+    _sumB(vector<double>()),
     _meanS(vector<double>(N.size(),0)),
     _meanB(vector<double>(N.size(),0)),      
-    _random(TRandom3()),
+    _random(CounterRNG()),
     _nbins((int)N.size()),
+    _npoints(0),
+    _stride(0),
     _index(-1),
-    _profile(false)
+    _profile(false),
+    _pS(0),
+    _pB(0),
+    _psumS(0),
+    _psumB(0),
+    _argmax(0)
 {}
 
+MultiPoisson::MultiPoisson(const MultiPoisson& o)
+  : PDFunction(),
+    _N(o._N),
+    _Ngen(o._Ngen),
+    _S(o._S),
+    _B(o._B),
+    _sumS(o._sumS),
+    _sumB(o._sumB),
+    _meanS(o._meanS),
+    _meanB(o._meanB),    
+    _random(o._random),
+    _nbins(o._nbins),
+    _npoints(o._npoints),
+    _stride(o._stride),
+    _index(o._index),
+    _profile(o._profile),
+    _pS(o._pS),
+    _pB(o._pB),
+    _psumS(o._psumS),
+    _psumB(o._psumB),
+    _file(o._file),
+    _profilecache(o._profilecache),
+    _argmax(o._argmax.load())
+{
+  _repoint();
+}
+
+MultiPoisson& 
+MultiPoisson::operator=(const MultiPoisson& o)
+{
+  if ( this == &o ) return *this;
+  _N = o._N;
+  _Ngen = o._Ngen;
+  _S = o._S;
+  _B = o._B;
+  _sumS = o._sumS;
+  _sumB = o._sumB;
+  _meanS = o._meanS;
+  _meanB = o._meanB;
+  _random = o._random;
+  _nbins = o._nbins;
+  _npoints = o._npoints;
+  _stride = o._stride;
+  _index = o._index;
+  _profile = o._profile;
+  _pS = o._pS;
+  _pB = o._pB;
+  _psumS = o._psumS;
+  _psumB = o._psumB;
+  _file = o._file;
+  _repoint();
+  std::lock_guard<std::mutex> lock(_cachelock);
+  _profilecache = o._profilecache;
+  _argmax = o._argmax.load();
+  return *this;
+}
+
 MultiPoisson::~MultiPoisson() 
 {}
 
- void MultiPoisson::add(vector<double>& S, vector<double>& B)
+void MultiPoisson::_readBinary(string filename)
 {
-  _S.push_back(S);
-  _B.push_back(B);
+  _file.reset(new SwarmFile(filename, SwarmFile::MULTIPOISSON));
+
+  // the bins are padded to a multiple of the SIMD width (see _reserve)
+  size_t nbins   = _file->nbins();
+  size_t npoints = _file->npoints();
+  size_t stride  = _file->stride();
+  if ( stride < npoints || stride % 8 != 0 )
+    {
+      Error("MultiPoisson", "%s has stride %d for %d points", 
+	    filename.c_str(), (int)stride, (int)npoints);
+      exit(0);
+    }
+  vector<size_t> lengths;
+  lengths.push_back(nbins);
+  lengths.push_back(nbins * stride);
+  lengths.push_back(nbins * stride);
+  lengths.push_back(npoints);
+  lengths.push_back(npoints);
+  lengths.push_back(nbins);
+  lengths.push_back(nbins);
+  _file->checkSections(lengths);
+
+  _nbins   = _file->nbins();
+  _npoints = _file->npoints();
+  _stride  = _file->stride();
+  _N.assign(_file->section(0), _file->section(0) + _nbins);
+  _Ngen  = _N;
+  _meanS.assign(_file->section(5), _file->section(5) + _nbins);
+  _meanB.assign(_file->section(6), _file->section(6) + _nbins);
+  _pS    = _file->section(1);
+  _pB    = _file->section(2);
+  _psumS = _file->section(3);
+  _psumB = _file->section(4);
+}
+
+void MultiPoisson::writeBinary(string filename)
+{
+  vector<pair<const double*, size_t> > sections;
+  sections.push_back(make_pair(_N.data(), (size_t)_nbins));
+  sections.push_back(make_pair(_pS, (size_t)_nbins * _stride));
+  sections.push_back(make_pair(_pB, (size_t)_nbins * _stride));
+  sections.push_back(make_pair(_psumS, (size_t)_npoints));
+  sections.push_back(make_pair(_psumB, (size_t)_npoints));
+  sections.push_back(make_pair(_meanS.data(), (size_t)_nbins));
+  sections.push_back(make_pair(_meanB.data(), (size_t)_nbins));
+  SwarmFile::write(filename, SwarmFile::MULTIPOISSON,
+		   _nbins, _npoints, _stride, sections);
+}
+
+void MultiPoisson::_repoint()
+{
+  if ( _file ) return;
+  _pS    = _S.data();
+  _pB    = _B.data();
+  _psumS = _sumS.data();
+  _psumB = _sumB.data();
+}
+
+void MultiPoisson::_unmap()
+{
+  if ( ! _file ) return;
+  _S.assign(_pS, _pS + (size_t)_nbins * _stride);
+  _B.assign(_pB, _pB + (size_t)_nbins * _stride);
+  _sumS.assign(_psumS, _psumS + _npoints);
+  _sumB.assign(_psumB, _psumB + _npoints);
+  _file.reset();
+  _repoint();
+}
+
+void MultiPoisson::_reserve(int npoints)
+{
+  if ( npoints <= _stride ) return;
+
+  // pad each bin to a multiple of the SIMD width
+  int stride = 8 * ((npoints + 7) / 8);
+  vector<double> S(_nbins * stride, 0);
+  vector<double> B(_nbins * stride, 0);
+  for(int ibin=0; ibin < _nbins; ++ibin)
+    for(int ii=0; ii < _npoints; ++ii)
+      {
+	S[ibin*stride + ii] = _S[ibin*_stride + ii];
+	B[ibin*stride + ii] = _B[ibin*_stride + ii];
+      }
+  _S.swap(S);
+  _B.swap(B);
+  _stride = stride;
+  _repoint();
+}
+
+void MultiPoisson::add(vector<double>& S, vector<double>& B)
+{
+  _unmap();
+  if ( _npoints == _stride ) _reserve(2 * _stride > 8 ? 2 * _stride : 8);
+
+  double sumS = 0;
+  double sumB = 0;
+  for(int ibin=0; ibin < _nbins; ++ibin)
+    {
+      _S[ibin*_stride + _npoints] = S[ibin];
+      _B[ibin*_stride + _npoints] = B[ibin];
+      sumS += S[ibin];
+      sumB += B[ibin];
+    }
+  _sumS.push_back(sumS);
+  _sumB.push_back(sumB);
+  _npoints++;
+  _repoint();
+
+  std::lock_guard<std::mutex> lock(_cachelock);
+  _profilecache.reset();
 }
 
 void MultiPoisson::update(int ii, vector<double>& S)
 {
   if ( ii < 0 ) return;
-  if ( ii > (int)(_S.size()-1) ) return;
-  copy(S.begin(), S.end(), _S[ii].begin());
+  if ( ii > _npoints-1 ) return;
+  _unmap();
+  double sumS = 0;
+  for(int ibin=0; ibin < _nbins; ++ibin)
+    {
+      _S[ibin*_stride + ii] = S[ibin];
+      sumS += S[ibin];
+    }
+  _sumS[ii] = sumS;
+
+  std::lock_guard<std::mutex> lock(_cachelock);
+  _profilecache.reset();
 }
 
 void MultiPoisson::computeMeans()
 {
-  int M = _S.size();
+  int M = _npoints;
   for(int ibin=0; ibin < _nbins; ++ibin)
     {
       _meanS[ibin] = 0.0;
       _meanB[ibin] = 0.0;
       for(int ii=0; ii < M; ++ii)
 	{
-	  _meanS[ibin] += _S[ii][ibin];
-	  _meanB[ibin] += _B[ii][ibin];
+	  _meanS[ibin] += _pS[ibin*_stride + ii];
+	  _meanB[ibin] += _pB[ibin*_stride + ii];
 	}
       _meanS[ibin] /= M;
       _meanB[ibin] /= M;
@@ -247,7 +504,7 @@ void MultiPoisson::computeMeans()
 void MultiPoisson::set(int ii)
 {
   if ( ii < 0 ) return;
-  if ( ii > (int)(_S.size()-1) ) return;
+  if ( ii > _npoints-1 ) return;
   _index = ii;
 }
 
@@ -276,55 +533,392 @@ MultiPoisson::generate(double mu)
       Error("MultiPoisson", "nbins = 0, can't generate!");
       exit(0);
     }
-  int nconstants = _S.size();
-  int icon = _random.Integer(nconstants-1);      
+  int icon = _random.integer(_npoints);
   for(int ibin=0; ibin < _nbins; ++ibin)
     {
-      double mean = mu * _S[icon][ibin] + _B[icon][ibin];
-      _Ngen[ibin] = _random.Poisson(mean);
+      double mean = mu * _pS[ibin*_stride + icon] + _pB[ibin*_stride + icon];
+      _Ngen[ibin] = _random.poisson(mean);
     }
   return _Ngen;
 }
 
+void
+MultiPoisson::generateBatch(double mu, int ntoys, 
+			    vector<double>& data, long firststream)
+{
+  if(_nbins <= 0)
+    {
+      Error("MultiPoisson", "nbins = 0, can't generate!");
+      exit(0);
+    }
+  data.resize(ntoys > 0 ? ntoys * _nbins : 0);
+  if ( ntoys <= 0 ) return;
+
+  // one generator per toy, each drawing its numbers in the same order
+  // as generate, starting with the point from the swarm
+  vector<CounterRNG> rng(ntoys);
+  vector<int> icon(ntoys);
+  for(int t=0; t < ntoys; t++)
+    {
+      rng[t] = CounterRNG(_random.seed(), firststream + t);
+      icon[t] = rng[t].integer(_npoints);
+    }
+
+  vector<double> mean(ntoys), count(ntoys);
+  for(int ibin=0; ibin < _nbins; ++ibin)
+    {
+      const double* S = _pS + ibin*_stride;
+      const double* B = _pB + ibin*_stride;
+      for(int t=0; t < ntoys; t++) mean[t] = mu * S[icon[t]] + B[icon[t]];
+      CounterRNG::poisson(ntoys, &rng[0], &mean[0], &count[0]);
+      for(int t=0; t < ntoys; t++) data[t*_nbins + ibin] = count[t];
+    }
+  _random = rng[ntoys-1];
+}
+
+vector<double>
+MultiPoisson::asimov(double mu)
+{
+  vector<double> N(_nbins, 0);
+  if ( _npoints == 0 ) return N;
+  for(int ibin=0; ibin < _nbins; ++ibin)
+    {
+      const double* S = _pS + ibin*_stride;
+      const double* B = _pB + ibin*_stride;
+      for(int k=0; k < _npoints; ++k) N[ibin] += mu * S[k] + B[k];
+      N[ibin] /= _npoints;
+    }
+  return N;
+}
+
 double 
 MultiPoisson::operator() (std::vector<double>& N, double mu)
+{
+  return exp(logLikelihood(N, mu));
+}
+
+double 
+MultiPoisson::logLikelihood(std::vector<double>& N, double mu)
+{
+  Workspace& w = WORKSPACE;
+  w.poi.assign(1, mu);
+  evaluate(N, w.poi, w.lnL, true);
+  return w.lnL[0];
+}
+
+void
+MultiPoisson::evaluate(std::vector<double>& N, 
+		       std::vector<double>& mu,
+		       std::vector<double>& result, 
+		       bool uselog)
 {
   int first = 0;
-  int last  = _S.size()-1;
+  int last  = _npoints-1;
   if ( _index >= 0 )
     {
       first = _index;
       last  = _index;
     }
   int nconstants = 1 + last - first;
-
-  double likelihood = 0.0;
-  if ( _profile )
+  int nmu = (int)mu.size();
+  
+  result.resize(nmu);
+  for(int j=0; j < nmu; ++j) result[j] = -HUGE_VAL;
+  
+  if ( _profile && nconstants > 1 )
     {
-      // do something!
+      // maximize, rather than average, the likelihood over the swarm
+      double lnc = 0.0;
+      for(int ibin=0; ibin < _nbins; ++ibin) lnc -= TMath::LnGamma(N[ibin]+1);
+      for(int j=0; j < nmu; ++j)
+	{
+	  int kbest;
+	  result[j] = _profileLogLikelihood(N, mu[j], kbest) + lnc;
+	}
     }
-  else
+  else if ( nconstants > 0 )
     {
-      for(int icon=first; icon <= last; ++icon)
+      // average the likelihood over the swarm, scaling by the largest
+      // term so that the exponentials never underflow:
+      // ln sum_k exp(lnp_k) = lnmax + ln sum_k exp(lnp_k - lnmax).
+      // The swarm is processed in blocks of points that stay in cache
+      // while every value of mu is computed.
+      const int BLOCK = 256;
+      Workspace& w = WORKSPACE;
+      w.lnp.resize(nmu * BLOCK);
+      w.lnmax.assign(nmu, -HUGE_VAL);
+      w.sum.assign(nmu, 0.0);
+      vector<double>& lnp   = w.lnp;
+      vector<double>& lnmax = w.lnmax;
+      vector<double>& sum   = w.sum;
+      
+      for(int k0=first; k0 <= last; k0 += BLOCK)
 	{
-	  double p = 1.0;
-	  for(int ibin=0; ibin < _nbins; ++ibin)
+	  int npoints = min(BLOCK, last + 1 - k0);
+	  _logLikelihoods(N, mu, k0, npoints, &lnp[0]);
+	  
+	  for(int j=0; j < nmu; ++j)
 	    {
-	      double mean = mu * _S[icon][ibin] + _B[icon][ibin];
-	      p *= TMath::Poisson(N[ibin], mean);
+	      double* p = &lnp[j * npoints];
+	      double bmax = *max_element(p, p + npoints);
+	      if ( bmax == -HUGE_VAL ) continue;
+	      if ( bmax > lnmax[j] )
+		{
+		  sum[j]  *= exp(lnmax[j] - bmax);
+		  lnmax[j] = bmax;
+		}
+	      for(int k=0; k < npoints; ++k) sum[j] += exp(p[k] - lnmax[j]);
 	    }
-	  likelihood += p;
 	}
-      likelihood /= nconstants;
+
+      double lnc = 0.0;
+      for(int ibin=0; ibin < _nbins; ++ibin) lnc -= TMath::LnGamma(N[ibin]+1);
+      
+      for(int j=0; j < nmu; ++j)
+	if ( sum[j] > 0 ) 
+	  result[j] = lnmax[j] + log(sum[j] / nconstants) + lnc;
     }
-  return likelihood;
+
+  if ( ! uselog )
+    for(int j=0; j < nmu; ++j) result[j] = exp(result[j]);
+}
+
+void
+MultiPoisson::_logLikelihoods(std::vector<double>& N, std::vector<double>& mu,
+			      int first, int npoints, double* lnp)
+{
+  // For each mu_j and each point k, compute (up to a constant)
+  //   lnp[j * npoints + k] = sum_i N_i ln(mu_j S_ik + B_ik) 
+  //                        - mu_j sum_i S_ik - sum_i B_ik
+  int nmu = (int)mu.size();
+  for(int j=0; j < nmu; ++j)
+    {
+      double* p = lnp + j * npoints;
+      for(int k=0; k < npoints; ++k)
+	p[k] = -mu[j] * _psumS[first+k] - _psumB[first+k];
+    }
+  
+  for(int ibin=0; ibin < _nbins; ++ibin)
+    {
+      double n = N[ibin];
+      if ( n == 0 ) continue;
+      const double* S = _pS + ibin*_stride + first;
+      const double* B = _pB + ibin*_stride + first;
+      for(int j=0; j < nmu; ++j)
+	addLogMean(npoints, n, mu[j], S, B, lnp + j * npoints);
+    }
+}
+
+double
+MultiPoisson::_logLikelihood(std::vector<double>& N, double mu, int k)
+{
+  // the log-likelihood of point k, up to a constant
+  double lnp = -mu * _psumS[k] - _psumB[k];
+  for(int ibin=0; ibin < _nbins; ++ibin)
+    {
+      double n = N[ibin];
+      if ( n == 0 ) continue;
+      double mean = mu * _pS[ibin*_stride + k] + _pB[ibin*_stride + k];
+      lnp += n * (mean > 0 ? log(mean) : -HUGE_VAL);
+    }
+  return lnp;
+}
+
+shared_ptr<const MultiPoisson::ProfileCache>
+MultiPoisson::_profileCache(std::vector<double>& N, double mu, bool rebuild)
+{
+  std::lock_guard<std::mutex> lock(_cachelock);
+  if ( ! rebuild && 
+       _profilecache && 
+       _profilecache->counts == N &&
+       (int)_profilecache->lnp.size() == _npoints ) return _profilecache;
+
+  // The log-likelihood of each point is concave in mu, so it lies below
+  // its tangent at any value of mu. Compute the tangents at mu.
+  ProfileCache* cache = new ProfileCache();
+  cache->counts = N;
+  cache->mu = mu;
+  cache->lnp.resize(_npoints);
+  cache->slope.resize(_npoints);
+  for(int k=0; k < _npoints; ++k) cache->slope[k] = -_psumS[k];
+  for(int ibin=0; ibin < _nbins; ++ibin)
+    {
+      double n = N[ibin];
+      if ( n == 0 ) continue;
+      const double* S = _pS + ibin*_stride;
+      const double* B = _pB + ibin*_stride;
+      for(int k=0; k < _npoints; ++k)
+	cache->slope[k] += n * S[k] / (mu * S[k] + B[k]);
+    }
+  vector<double> poi(1, mu);
+  _logLikelihoods(N, poi, 0, _npoints, &cache->lnp[0]);
+  cache->kmax = argmax(_npoints, &cache->lnp[0]);
+
+  // a point whose tangent is undefined is always computed
+  for(int k=0; k < _npoints; ++k)
+    if ( ! (std::isfinite(cache->lnp[k]) && std::isfinite(cache->slope[k])) )
+      {
+	cache->lnp[k]   = HUGE_VAL;
+	cache->slope[k] = 0;
+      }
+  _profilecache.reset(cache);
+  return _profilecache;
+}
+
+double
+MultiPoisson::_profileLogLikelihood(std::vector<double>& N, double mu,
+				   int& kbest)
+{
+  shared_ptr<const ProfileCache> cache = _profileCache(N, mu);
+
+  // the point that maximized the likelihood last time, which is likely 
+  // to be close to the maximum for nearby values of mu, gives a lower
+  // bound on the maximum...
+  kbest = cache->mu == mu ? cache->kmax : min((int)_argmax, _npoints-1);
+  double best = _logLikelihood(N, mu, kbest);
+
+  // ...so only points whose tangent exceeds it need be computed
+  double bound = best - 1.e-9 * (1 + abs(best));
+  double dmu = mu - cache->mu;
+  CANDIDATES.clear();
+  for(int k=0; k < _npoints; ++k)
+    if ( cache->lnp[k] + dmu * cache->slope[k] > bound ) 
+      CANDIDATES.push_back(k);
+
+  if ( (int)CANDIDATES.size() > _npoints / 8 )
+    {
+      // too far from the tangent points: compute all points and
+      // replace the tangents with those at this mu
+      cache = _profileCache(N, mu, true);
+      kbest = cache->kmax;
+      best  = _logLikelihood(N, mu, kbest);
+      bound = best - 1.e-9 * (1 + abs(best));
+      CANDIDATES.clear();
+      for(int k=0; k < _npoints; ++k)
+	if ( cache->lnp[k] > bound ) CANDIDATES.push_back(k);
+    }
+
+  for(size_t c=0; c < CANDIDATES.size(); ++c)
+    {
+      int k = CANDIDATES[c];
+      double lnp = _logLikelihood(N, mu, k);
+      if ( lnp > best )
+	{
+	  best  = lnp;
+	  kbest = k;
+	}
+    }
+  _argmax = kbest;
+  return best;
+}
+
+bool
+MultiPoisson::derivatives(std::vector<double>& N, double mu,
+			  double& lnL, double& d1, double& d2)
+{
+  lnL = -HUGE_VAL;
+  d1 = d2 = 0;
+  int first = 0;
+  int last  = _npoints-1;
+  if ( _index >= 0 )
+    {
+      first = _index;
+      last  = _index;
+    }
+  int nconstants = 1 + last - first;
+  if ( nconstants <= 0 ) return true;
+
+  double lnc = 0.0;
+  for(int ibin=0; ibin < _nbins; ++ibin) lnc -= TMath::LnGamma(N[ibin]+1);
+  
+  if ( _profile && nconstants > 1 )
+    {
+      // the derivatives of the maximum are those of the point at the
+      // maximum
+      int k;
+      lnL = _profileLogLikelihood(N, mu, k) + lnc;
+      double g = -_psumS[k];
+      double h = 0;
+      for(int ibin=0; ibin < _nbins; ++ibin)
+	if ( N[ibin] > 0 )
+	  addDerivatives(1, N[ibin], mu, _pS + ibin*_stride + k, 
+			 _pB + ibin*_stride + k, &g, &h);
+      d1 = g;
+      d2 = h;
+      return true;
+    }
+
+  // The likelihood is the average of the likelihoods L_k of the points,
+  // so its derivatives are averages weighted by w_k = L_k / sum_k L_k:
+  //   d lnL / d mu   = <g>, and
+  //   d2 lnL / d mu2 = <h + g^2> - <g>^2,
+  // where g_k = sum_i N_i S_ik / (mu S_ik + B_ik) - sum_i S_ik and 
+  // h_k = -sum_i N_i S_ik^2 / (mu S_ik + B_ik)^2. As in evaluate(),
+  // the weights are scaled by the largest likelihood.
+  const int BLOCK = 256;
+  vector<double> mus(1, mu);
+  vector<double> lnp(BLOCK), g(BLOCK), h(BLOCK);
+  double lnmax = -HUGE_VAL;
+  double sum0 = 0, sum1 = 0, sum2 = 0;
+  for(int k0=first; k0 <= last; k0 += BLOCK)
+    {
+      int npoints = min(BLOCK, last + 1 - k0);
+      _logLikelihoods(N, mus, k0, npoints, &lnp[0]);
+      for(int k=0; k < npoints; ++k)
+	{
+	  g[k] = -_psumS[k0+k];
+	  h[k] = 0;
+	}
+      for(int ibin=0; ibin < _nbins; ++ibin)
+	{
+	  double n = N[ibin];
+	  if ( n == 0 ) continue;
+	  addDerivatives(npoints, n, mu, _pS + ibin*_stride + k0, 
+			 _pB + ibin*_stride + k0, &g[0], &h[0]);
+	}
+
+      double bmax = *max_element(&lnp[0], &lnp[0] + npoints);
+      if ( bmax == -HUGE_VAL ) continue;
+      if ( bmax > lnmax )
+	{
+	  double scale = exp(lnmax - bmax);
+	  sum0 *= scale;
+	  sum1 *= scale;
+	  sum2 *= scale;
+	  lnmax = bmax;
+	}
+      for(int k=0; k < npoints; ++k)
+	{
+	  if ( lnp[k] == -HUGE_VAL ) continue;
+	  double w = exp(lnp[k] - lnmax);
+	  sum0 += w;
+	  sum1 += w * g[k];
+	  sum2 += w * (h[k] + g[k] * g[k]);
+	}
+    }
+  if ( sum0 > 0 )
+    {
+      lnL = lnmax + log(sum0 / nconstants) + lnc;
+      d1  = sum1 / sum0;
+      d2  = sum2 / sum0 - d1 * d1;
+    }
+  return true;
 }
 
 void 
-MultiPoisson::setSeed(int seed) { _random.SetSeed(seed); }
+MultiPoisson::setSeed(int seed) { _random.setSeed(seed); }
+
+void
+MultiPoisson::setStream(long stream) { _random.setStream(stream); }
 
 double 
 MultiPoisson::operator() (double mu)
 {
   return (*this)(_N, mu);
 }
+
+double 
+MultiPoisson::logLikelihood(double mu)
+{
+  return logLikelihood(_N, mu);
+}
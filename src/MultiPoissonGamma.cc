@@ -13,45 +13,47 @@
 #include <fstream>
 #include <sstream>
 #include <cmath>
+#include <map>
+#include "TROOT.h"
 #include "TMath.h"
 #include "TString.h"
 #include "TFile.h"
 #include "TH1.h"
 #include "TError.h"
 #include "MultiPoissonGamma.h"
+#include "SwarmFile.h"
+#include "SwarmReader.h"
+#include "ThreadPool.h"
 
 using namespace std;
 
 namespace {
-  ///
-  std::string strip(std::string line)
+  // largest number of background coefficients to cache for the swarm
+  const size_t MAXCACHE=1 << 22;
+
+  // workspace for the averaged likelihood, one per thread, so that
+  // logLikelihood does not allocate on every call
+  struct Workspace
   {
-    int l = line.size();
-    if ( l == 0 ) return std::string("");
-    int n = 0;
-    while (((line[n] == 0)    ||
-	    (line[n] == ' ' ) ||
-	    (line[n] == '\n') ||
-	    (line[n] == '\t')) && n < l) n++;
-    
-    int m = l-1;
-    while (((line[m] == 0)    ||
-	    (line[m] == ' ')  ||
-	    (line[m] == '\n') ||
-	    (line[m] == '\t')) && m > 0) m--;
-    return line.substr(n,m-n+1);
-  }
+    vector<double> poi, lnL, lnmax, sum;
+  };
+  thread_local Workspace WORKSPACE;
 };
 
 MultiPoissonGamma::MultiPoissonGamma()
   : PDFunction(),
     _N(vector<double>()),
     _Ngen(vector<double>()),
-    _model(vector<MultiPoissonGammaModel>()),
-    _random(TRandom3()),
+    _random(CounterRNG()),
     _nbins(0),
+    _npoints(0),
     _index(-1),
-    _profile(false)
+    _profile(false),
+    _px(0),
+    _pa(0),
+    _py(0),
+    _pb(0),
+    _argmax(0)
 {}
 
 
@@ -59,63 +61,49 @@ MultiPoissonGamma::MultiPoissonGamma(string filename)
   : PDFunction(),
     _N(vector<double>()),
     _Ngen(vector<double>()),
-    _model(vector<MultiPoissonGammaModel>()),
-    _random(TRandom3()),
+    _random(CounterRNG()),
     _nbins(0),
+    _npoints(0),
     _index(-1),
-    _profile(false) 
+    _profile(false),
+    _px(0),
+    _pa(0),
+    _py(0),
+    _pb(0),
+    _argmax(0)
 {
-  // examine file and determine whether we have histogram input)
-  ifstream inp(filename.c_str());
-  if ( ! inp.good() )
+  if ( SwarmFile::isBinary(filename) )
     {
-      cout << "** MultiPoissonGamma - unable to open file "
-	   << filename << endl;
-      exit(0);
+      _readBinary(filename);
+      return;
     }
   
-  // read lines
-  vector<string> records;
-  string line;
-  bool useHistograms = false;
-  
-  while(getline(inp, line))
-    {
-      // remove blank lines
-      line = strip(line);
-      if (line == "") continue;
-      
-      // remove lines that start with #
-      if (line.substr(0,1) == "#") continue;
-
-      // check if a line contains the name of a root file
-      // if so, assume histogram input has been specified for
-      // all input data
-      TString str(line.c_str());
-      if ( str.Contains(".root") ) useHistograms = true;
-      
-      records.push_back(line);
-    }
+  SwarmReader reader(filename);
+  _readText(reader, -1);
+}
 
-  if (records.size() == 0)
-    {
-      Error("MultiPoisson",
-	    "zero uncommented records in file %s", filename.c_str());
-      exit(0);
-    }
-    
-  // now decode 
-  if ( useHistograms )
-    _readRootFile(records);
-  else
-    _readTextFile(records);
+MultiPoissonGamma::MultiPoissonGamma(SwarmReader& reader, int npoints)
+  : PDFunction(),
+    _N(vector<double>()),
+    _Ngen(vector<double>()),
+    _random(CounterRNG()),
+    _nbins(0),
+    _npoints(0),
+    _index(-1),
+    _profile(false),
+    _px(0),
+    _pa(0),
+    _py(0),
+    _pb(0),
+    _argmax(0)
+{
+  _readText(reader, npoints);
 }
 
 void
-MultiPoissonGamma::_readTextFile(vector<string>& records)
+MultiPoissonGamma::_readText(SwarmReader& reader, int npoints)
 {
-  // open input text file with format
-  // open input text file with format
+  // text file format
   // number of bins  ... 
   // count1 count2 ...
   // number of points
@@ -124,111 +112,103 @@ MultiPoissonGamma::_readTextFile(vector<string>& records)
   // B1   B2   ...
   // dB1  dB2  ...
 
-  // get number of bins
-  _nbins = 0;
-  int lineno = 0;
-  stringstream hin(records[lineno]);
-  try
+  vector<string> records(2);
+  if ( ! reader.next(records[0]) || ! reader.next(records[1]) )
     {
-      hin >> _nbins;
+      Error("MultiPoissonGamma",
+	    "too few uncommented records in file %s", 
+	    reader.filename().c_str());
+      exit(0);
     }
-  catch (...)
+
+  // if the data are specified as the name of a root file, assume 
+  // histogram input has been specified for all input data. The 
+  // records then contain file and histogram names, so are few.
+  TString str(records[1].c_str());
+  if ( str.Contains(".root") )
     {
-      Error("MultiPoisson",
+      string record;
+      while ( reader.next(record) ) records.push_back(record);
+      _readRootFile(records);
+      return;
+    }
+
+  // get number of bins
+  _nbins = atoi(records[0].c_str());
+  if ( _nbins <= 0 )
+    {
+      Error("MultiPoissonGamma",
 	    "unable to get number of bins; check file format");
       exit(0);
-    }  
+    }
 
   // get observed counts
-  vector<double> sig;
-  vector<double> dsig;
-  vector<double> bkg;
-  vector<double> dbkg;
-  lineno++;
-  stringstream din(records[lineno]);
-  
-  int c = 0;
-  double x;
-  for(int i=0; i < _nbins; i++)
+  _N.resize(_nbins);
+  if ( SwarmReader::decode(records[1], _nbins, &_N[0]) < _nbins )
     {
-     try
-	{
-	  c++;
-	  din >> x;
-	}
-      catch (...)
-	{
-	  Error("MultiPoissonGamma",
-		"problem accessing observed count at bin %d", c);
-	  exit(0);	  
-	}
-      _N.push_back(x);
-      _Ngen.push_back(0);
-      sig.push_back(0);
-      bkg.push_back(0);
-      dsig.push_back(0);
-      dbkg.push_back(0);
+      Error("MultiPoissonGamma",
+	    "problem accessing observed counts:\n%s", records[1].c_str());
+      exit(0);
     }
+  _Ngen.assign(_nbins, 0);
   
   // get number of samples
+  string record;
   int samplesize = 0;
-  lineno++;
-  stringstream nin(records[lineno]);
-  try
-    {
-      nin >> samplesize;
-    }
-  catch (...)
+  if ( reader.next(record) ) samplesize = atoi(record.c_str());
+  if ( samplesize <= 0 )
     {
       Error("MultiPoissonGamma",
 	    "unable to get sample size; check file format");
       exit(0);
-    }  
+    }
+  if ( npoints < 0 || npoints > samplesize ) npoints = samplesize;
+
+  size_t size = (size_t)samplesize * _nbins;
+  _x.reserve(size);
+  _a.reserve(size);
+  _y.reserve(size);
+  _b.reserve(size);
+  read(reader, npoints);
+}
 
-  // loop over sampled points  
-  for(int ii=0; ii < samplesize; ii++)
+int
+MultiPoissonGamma::read(SwarmReader& reader, int npoints)
+{
+  vector<double> sig(_nbins);
+  vector<double> dsig(_nbins);
+  vector<double> bkg(_nbins);
+  vector<double> dbkg(_nbins);
+  vector<double> values;
+  int count = 0;
+  while ( count < npoints )
     {
-      try
+      // decode a chunk of points, each given by four lines: signals, 
+      // their uncertainties, backgrounds, and their uncertainties
+      int chunk = max(1, (int)SwarmReader::CHUNKSIZE / (4*_nbins));
+      chunk = min(npoints - count, chunk);
+      int nrecords = reader.read(4*chunk, _nbins, values);
+      if ( nrecords % 4 != 0 )
 	{
-	  // get signals
-	  lineno++;
-	  stringstream sin(records[lineno]);
-	  for(int i=0; i < _nbins; i++) sin >> sig[i];
-      
-	  // get associated uncertainties
-	  lineno++;
-	  stringstream dsin(records[lineno]);
-	  for(int i=0; i < _nbins; i++) dsin >> dsig[i];
-	}
-      catch (...)
-	{
-	  Error("MultiPoisson",
-		"problem decoding signal counts:\n%s",
-		records[lineno].c_str());
-	  exit(0);      
-	}
-
-      try
-	{
-	  // get backgrounds
-	  lineno++;
-	  stringstream bin(records[lineno]);
-	  for(int i=0; i < _nbins; i++) bin >> bkg[i];
-      
-	  // get background uncertainties
-	  lineno++;
-	  stringstream dbin(records[lineno]);
-	  for(int i=0; i < _nbins; i++) dbin >> dbkg[i];
+	  Error("MultiPoissonGamma", 
+		"incomplete sampled point at end of file %s",
+		reader.filename().c_str());
+	  exit(0);
 	}
-      catch (...)
+      int n = nrecords / 4;
+      for(int ii=0; ii < n; ii++)
 	{
-	  Error("MultiPoisson",
-		"problem decoding background counts:\n%s",
-		records[lineno].c_str());
-	  exit(0);	  
+	  const double* row = &values[4*ii*_nbins];
+	  copy(row, row + _nbins, sig.begin());
+	  copy(row + _nbins, row + 2*_nbins, dsig.begin());
+	  copy(row + 2*_nbins, row + 3*_nbins, bkg.begin());
+	  copy(row + 3*_nbins, row + 4*_nbins, dbkg.begin());
+	  add(sig, dsig, bkg, dbkg);
 	}
-      add(sig, dsig, bkg, dbkg);
+      count += n;
+      if ( n < chunk ) break;
     }
+  return count;
 }
 
 void
@@ -256,50 +236,9 @@ MultiPoissonGamma::_readRootFile(vector<string>& records)
       exit(0);
     }
 
-  // Get observed counts
-  // rfilename = root file name
-  // histname  = histogram name
-  lineno++;
-  istringstream iin(records[lineno]);
-  string rfilename, histname;
-  iin >> rfilename >> histname;
-
-  vector<double> c;
-  vector<double> dc;
-  _getcounts(rfilename, histname, c, dc);
-  if ( _nbins <= 0 ) _nbins = (int)c.size();
-  
-  if (_nbins != (int)c.size())
-    Warning("MultiPoissonGamma",
-	    "number of bins specified %d != number of bins %d "
-	    "in data histogram\n"
-	    "will use smaller bin count", _nbins, (int)c.size());
-  _nbins = min(_nbins, (int)c.size());
-  
-  // open output text file
-  string ofilename("limits.txt");
-  ofstream fout(ofilename.c_str());
-  
-  // write out number of bins
-  fout << "# automatically generated by MultiPoissonGamma" << endl;
-  fout << "# number of bins" << endl;
-  fout << _nbins << endl;
-  
-  char arecord[10000];
-  
-  // write out observed counts
-  fout << "# observed counts" << endl;
-  for(int i=0; i < _nbins; i++)
-    {
-      sprintf(arecord, " %9.0f", c[i]);
-      fout << arecord;
-    }
-  fout << endl;
-  
   // get number of samples
   int samplesize = 0;
-  lineno++;
-  stringstream nin(records[lineno]);
+  stringstream nin(records.size() > 2 ? records[2] : string(""));
   try
     {
       nin >> samplesize;
@@ -310,133 +249,128 @@ MultiPoissonGamma::_readRootFile(vector<string>& records)
 	    "unable to get sample size; check file format");
       exit(0);
     }
+  if ( (int)records.size() < 3 + 2*samplesize )
+    {
+      Error("MultiPoissonGamma",
+	    "expected %d histograms, found %d; check file format",
+	    1 + 2*samplesize, (int)records.size() - 2);
+      exit(0);
+    }
   
-  fout << "# number of sampled points" << endl;
-  fout << samplesize << endl;
+  // get the (root file name, histogram name) of the data, followed by
+  // those of the signal and background of each sampled point
+  vector<string> rfilenames;
+  vector<string> histnames;
+  for(int r=1; r < 3 + 2*samplesize; r++)
+    {
+      if ( r == 2 ) continue;
+      istringstream iin(records[r]);
+      string rfilename, histname;
+      iin >> rfilename >> histname;
+      rfilenames.push_back(rfilename);
+      histnames.push_back(histname);
+    }
   
-  // loop over sample
+  // read the histograms directly into memory. Each file is opened 
+  // once and the files are read in parallel, one file per task.
+  map<string, vector<int> > files;
+  for(size_t h=0; h < rfilenames.size(); h++)
+    files[rfilenames[h]].push_back(h);
+  vector<const vector<int>*> tasks;
+  for(map<string, vector<int> >::iterator it=files.begin();
+      it != files.end(); ++it)
+    tasks.push_back(&it->second);
   
-  for(int ii=0; ii < samplesize; ii++)
+  // A task that fails records why and stops; the failures are
+  // reported here, once all the tasks are done.
+  vector<vector<double> > c(histnames.size());
+  vector<vector<double> > dc(histnames.size());
+  vector<string> failures(tasks.size());
+  ThreadPool::instance().run((int)tasks.size(), 
+    [&](int t)
     {
-      // write out signals      
-      lineno++;
-      istringstream sin(records[lineno]);
-      sin >> rfilename >> histname;
-      _getcounts(rfilename, histname, c, dc);
-      if ( (int)c.size() < _nbins )
-	{
-	  Error("MultiPoissonGamma",
-		"bin count %d for histogram %s/%s < %d",
-		(int)c.size(), 
-		rfilename.c_str(),
-		histname.c_str(),
-		_nbins);
-	  exit(0);
-	}
-      
-      fout << "# " << ii+1 <<  " signal " << endl;
-      
-      // write out counts
-	
-      for(int i=0; i < _nbins; i++)
-	{
-	  sprintf(arecord, " %9.3e", c[i]);
-	  fout << arecord;
-	}
-      fout << endl;
-      fout << "# signal uncertainties" << endl;
-      
-      // write out uncertainties
-      for(int i=0; i < _nbins; i++)
-	{
-	  sprintf(arecord, " %9.3e", dc[i]);
-	  fout << arecord;
-	}
-      fout << endl;
-
-      // write out backgrounds
-      lineno++;
-      istringstream bin(records[lineno]);
-      bin >> rfilename >> histname;
-      _getcounts(rfilename, histname, c, dc);
-      if ( (int)c.size() != _nbins )
-	{
-	  Error("MultiPoissonGamma",
-		"bin count %d for histogram %s/%s < %d",
-		(int)c.size(), 
-		rfilename.c_str(),
-		histname.c_str(),
-		_nbins);
-	  exit(0);
-	}
-
-      fout << "# " << ii+1 << " backgrounds" << endl;
-      
-      // write out counts
-      for(int i=0; i < _nbins; i++)
+      const vector<int>& hists = *tasks[t];
+      string rfilename = rfilenames[hists[0]];
+      TFile rfile(rfilename.c_str());
+      if ( ! rfile.IsOpen() )
 	{
-	  sprintf(arecord, " %9.3e", c[i]);
-	  fout << arecord;
+	  failures[t] = "unable to open file " + rfilename;
+	  return;
 	}
-      fout << endl;
-      fout << "# background uncertainties" << endl;
-      
-      // write out uncertainties
-      for(int i=0; i < _nbins; i++)
+      for(size_t k=0; k < hists.size(); k++)
 	{
-	  sprintf(arecord, " %9.3e", dc[i]);
-	  fout << arecord;
+	  int h = hists[k];
+	  if ( ! _getcounts(rfile, histnames[h], c[h], dc[h]) )
+	    {
+	      failures[t] = "unable to get histogram " + histnames[h] +
+		" from file " + rfilename;
+	      break;
+	    }
 	}
-      fout << endl;      
-    }
-
-  // -------------------------------------------------------  
-  // now read text file that's just been created
-  // -------------------------------------------------------
-  ifstream inp(ofilename.c_str());
-  if ( ! inp.good() )
+      rfile.Close();
+    });
+  bool failed = false;
+  for(size_t t=0; t < failures.size(); t++)
+    if ( failures[t] != "" )
+      {
+	Error("MultiPoissonGamma", "%s", failures[t].c_str());
+	failed = true;
+      }
+  if ( failed ) exit(0);
+
+  // observed counts
+  if ( _nbins <= 0 ) _nbins = (int)c[0].size();
+  if (_nbins != (int)c[0].size())
+    Warning("MultiPoissonGamma",
+	    "number of bins specified %d != number of bins %d "
+	    "in data histogram\n"
+	    "will use smaller bin count", _nbins, (int)c[0].size());
+  _nbins = min(_nbins, (int)c[0].size());
+  for(int i=0; i < _nbins; i++)
     {
-      Error("MultiPoissonGamma",
-	    "unable to open file %s", ofilename.c_str());
-      exit(0);
+      _N.push_back(floor(c[0][i] + 0.5));
+      _Ngen.push_back(0);
     }
-  
-  vector<string> orecords;
-  string line;
-  while(getline(inp, line))
+
+  // sampled points
+  for(int h=1; h < (int)histnames.size(); h++)
+    if ( (int)c[h].size() < _nbins )
+      {
+	Error("MultiPoissonGamma",
+	      "bin count %d for histogram %s/%s < %d",
+	      (int)c[h].size(), 
+	      rfilenames[h].c_str(),
+	      histnames[h].c_str(),
+	      _nbins);
+	exit(0);
+      }
+  _x.reserve((size_t)samplesize * _nbins);
+  _a.reserve((size_t)samplesize * _nbins);
+  _y.reserve((size_t)samplesize * _nbins);
+  _b.reserve((size_t)samplesize * _nbins);
+  for(int ii=0; ii < samplesize; ii++)
     {
-      // remove blank lines
-      line = strip(line);
-      if (line == "") continue;
-      // remove lines that start with #
-      if (line.substr(0,1) == "#") continue;
-      orecords.push_back(line);
+      vector<double>& sig  = c[1 + 2*ii];
+      vector<double>& dsig = dc[1 + 2*ii];
+      vector<double>& bkg  = c[2 + 2*ii];
+      vector<double>& dbkg = dc[2 + 2*ii];
+      sig.resize(_nbins);
+      dsig.resize(_nbins);
+      bkg.resize(_nbins);
+      dbkg.resize(_nbins);
+      add(sig, dsig, bkg, dbkg);
     }
-  _readTextFile(orecords);  
 }
 
-void
-MultiPoissonGamma::_getcounts(string rfilename, string histname,
+bool
+MultiPoissonGamma::_getcounts(TFile& rfile, string histname,
 			      vector<double>& c, vector<double>& dc)
 {
   c.clear();
   dc.clear();
   
-  TFile rfile(rfilename.c_str());
-  if ( ! rfile.IsOpen() )
-    {
-      Error("MultiPoissonGamma", "unable to open file %s",
-	    rfilename.c_str());
-      exit(0);
-    }
   TH1* h = (TH1*)rfile.Get(histname.c_str());
-  if ( ! h )
-    {
-      Error("MultiPoissonGamma",
-	    "unable to get histogram %s from file %s",
-	    histname.c_str(), rfilename.c_str());
-      exit(0);
-    }
+  if ( ! h ) return false;
 
   if ( h->InheritsFrom("TH2") )
     {
@@ -455,21 +389,144 @@ MultiPoissonGamma::_getcounts(string rfilename, string histname,
 	  dc.push_back(h->GetBinError(i+1));
 	}
     }
-  rfile.Close();
+  return true;
 }
 
 MultiPoissonGamma::MultiPoissonGamma(vector<double>& N)
   : PDFunction(),
     _N(N),
     _Ngen(N),
-    _random(TRandom3()),
+    _random(CounterRNG()),
     _nbins((int)N.size()),
+    _npoints(0),
     _index(-1),
-    _profile(false)
+    _profile(false),
+    _px(0),
+    _pa(0),
+    _py(0),
+    _pb(0),
+    _argmax(0)
 {}
 
+MultiPoissonGamma::MultiPoissonGamma(const MultiPoissonGamma& o)
+  : PDFunction(),
+    _N(o._N),
+    _Ngen(o._Ngen),
+    _x(o._x),
+    _a(o._a),
+    _y(o._y),
+    _b(o._b),
+    _random(o._random),
+    _nbins(o._nbins),
+    _npoints(o._npoints),
+    _index(o._index),
+    _profile(o._profile),
+    _px(o._px),
+    _pa(o._pa),
+    _py(o._py),
+    _pb(o._pb),
+    _file(o._file),
+    _cache(o._cache),
+    _argmax(o._argmax.load())
+{
+  _repoint();
+}
+
+MultiPoissonGamma& 
+MultiPoissonGamma::operator=(const MultiPoissonGamma& o)
+{
+  if ( this == &o ) return *this;
+  _N = o._N;
+  _Ngen = o._Ngen;
+  _x = o._x;
+  _a = o._a;
+  _y = o._y;
+  _b = o._b;
+  _random = o._random;
+  _nbins = o._nbins;
+  _npoints = o._npoints;
+  _index = o._index;
+  _profile = o._profile;
+  _px = o._px;
+  _pa = o._pa;
+  _py = o._py;
+  _pb = o._pb;
+  _file = o._file;
+  _repoint();
+  _argmax = o._argmax.load();
+  std::lock_guard<std::mutex> lock(_cachelock);
+  _cache = o._cache;
+  return *this;
+}
+
 MultiPoissonGamma::~MultiPoissonGamma() 
-{}
+{
+}
+
+void MultiPoissonGamma::_readBinary(string filename)
+{
+  _file.reset(new SwarmFile(filename, SwarmFile::MULTIPOISSONGAMMA));
+
+  // the points are stored one after the other, nbins values each
+  size_t nbins = _file->nbins();
+  size_t size  = nbins * _file->npoints();
+  if ( _file->stride() != _file->nbins() )
+    {
+      Error("MultiPoissonGamma", "%s has stride %d for %d bins", 
+	    filename.c_str(), _file->stride(), _file->nbins());
+      exit(0);
+    }
+  vector<size_t> lengths;
+  lengths.push_back(nbins);
+  lengths.push_back(size);
+  lengths.push_back(size);
+  lengths.push_back(size);
+  lengths.push_back(size);
+  _file->checkSections(lengths);
+
+  _nbins   = _file->nbins();
+  _npoints = _file->npoints();
+  _N.assign(_file->section(0), _file->section(0) + _nbins);
+  _Ngen = _N;
+  _px   = _file->section(1);
+  _pa   = _file->section(2);
+  _py   = _file->section(3);
+  _pb   = _file->section(4);
+}
+
+void MultiPoissonGamma::writeBinary(string filename)
+{
+  size_t size = (size_t)_npoints * _nbins;
+  vector<pair<const double*, size_t> > sections;
+  sections.push_back(make_pair(_N.data(), (size_t)_nbins));
+  sections.push_back(make_pair(_px, size));
+  sections.push_back(make_pair(_pa, size));
+  sections.push_back(make_pair(_py, size));
+  sections.push_back(make_pair(_pb, size));
+  SwarmFile::write(filename, SwarmFile::MULTIPOISSONGAMMA,
+		   _nbins, _npoints, _nbins, sections);
+}
+
+void MultiPoissonGamma::_repoint()
+{
+  if ( _file ) return;
+  _px = _x.data();
+  _pa = _a.data();
+  _py = _y.data();
+  _pb = _b.data();
+}
+
+void MultiPoissonGamma::_unmap()
+{
+  if ( ! _file ) return;
+  size_t size = (size_t)_npoints * _nbins;
+  _x.assign(_px, _px + size);
+  _a.assign(_pa, _pa + size);
+  _y.assign(_py, _py + size);
+  _b.assign(_pb, _pb + size);
+  _file.reset();
+  _repoint();
+}
 
 void MultiPoissonGamma::add(vector<double>& sig, vector<double>& dsig,
 			    vector<double>& bkg, vector<double>& dbkg)
@@ -484,10 +541,21 @@ void MultiPoissonGamma::add(vector<double>& sig, vector<double>& dsig,
   vector<double> b;
   _convert(bkg, dbkg, y, b);
 
-  _model.push_back( MultiPoissonGammaModel(_N, x, a, y, b) );
-  if ( _model.size() % 50 == 0 )
+  _unmap();
+  _x.insert(_x.end(), x.begin(), x.end());
+  _a.insert(_a.end(), a.begin(), a.end());
+  _y.insert(_y.end(), y.begin(), y.end());
+  _b.insert(_b.end(), b.begin(), b.end());
+  _npoints++;
+  _repoint();
+  {
+    // the cached coefficients cover the previous points only
+    std::lock_guard<std::mutex> lock(_cachelock);
+    _cache.reset();
+  }
+  if ( _npoints % 50 == 0 )
     cout << "=> MultiPoissonGamma: added "
-	 << _model.size() << " distributions" << endl;
+	 << _npoints << " distributions" << endl;
 }
 
 void MultiPoissonGamma::update(int ii,
@@ -495,18 +563,20 @@ void MultiPoissonGamma::update(int ii,
 			       vector<double>& dsig)
 {
   if ( ii < 0 ) return;
-  if ( ii > (int)(_model.size()-1) ) return;
+  if ( ii > _npoints-1 ) return;
 
   vector<double> x;
   vector<double> a;
   _convert(sig, dsig, x, a);
-  _model[ii].setX(x, a);
+  _unmap();
+  copy(x.begin(), x.end(), _x.begin() + ii*_nbins);
+  copy(a.begin(), a.end(), _a.begin() + ii*_nbins);
 }
 
 void MultiPoissonGamma::set(int ii)
 {
   if ( ii < 0 ) return;
-  if ( ii > (int)(_model.size()-1) ) return;
+  if ( ii > _npoints-1 ) return;
   _index = ii;
 }
 
@@ -518,49 +588,381 @@ void MultiPoissonGamma::reset()
 vector<double>&  
 MultiPoissonGamma::generate(double mu)
 {
-  if(_nbins == 0)
+  if(_nbins == 0 || _npoints == 0)
     {
-      cout << "MultiPoissonGamma::generate: nbins = 0" << endl;
+      cout << "MultiPoissonGamma::generate: nbins = " << _nbins
+	   << ", npoints = " << _npoints << endl;
       exit(0);
     }
 
-  int ii = _random.Integer(_model.size()-1);
-  _Ngen  = _model[ii].generate(mu);
+  // pick a point from the swarm
+  int ii = _random.integer(_npoints);
+  const double* x = _px + ii*_nbins;
+  const double* a = _pa + ii*_nbins;
+  const double* y = _py + ii*_nbins;
+  const double* b = _pb + ii*_nbins;
+  
+  for(int i=0; i < _nbins; ++i)
+    {
+      double epsilon = _random.gamma(x[i]+0.5, 1.0/a[i]);
+      double bkg     = _random.gamma(y[i]+0.5, 1.0/b[i]);
+      _Ngen[i] = _random.poisson(epsilon * mu + bkg);
+    }
   return _Ngen;
 }
 
+void
+MultiPoissonGamma::generateBatch(double mu, int ntoys, 
+				 vector<double>& data, long firststream)
+{
+  if(_nbins == 0 || _npoints == 0)
+    {
+      cout << "MultiPoissonGamma::generateBatch: nbins = " << _nbins
+	   << ", npoints = " << _npoints << endl;
+      exit(0);
+    }
+  data.resize(ntoys > 0 ? ntoys * _nbins : 0);
+  if ( ntoys <= 0 ) return;
+
+  // one generator per toy, each drawing its numbers in the same order
+  // as generate, starting with the point from the swarm
+  vector<CounterRNG> rng(ntoys);
+  vector<int> point(ntoys);
+  for(int t=0; t < ntoys; t++)
+    {
+      rng[t] = CounterRNG(_random.seed(), firststream + t);
+      point[t] = rng[t].integer(_npoints) * _nbins;
+    }
+
+  vector<double> shape(ntoys), scale(ntoys);
+  vector<double> epsilon(ntoys), bkg(ntoys), mean(ntoys), count(ntoys);
+  for(int i=0; i < _nbins; ++i)
+    {
+      for(int t=0; t < ntoys; t++)
+	{
+	  shape[t] = _px[point[t] + i] + 0.5;
+	  scale[t] = 1.0/_pa[point[t] + i];
+	}
+      CounterRNG::gamma(ntoys, &rng[0], &shape[0], &scale[0], &epsilon[0]);
+
+      for(int t=0; t < ntoys; t++)
+	{
+	  shape[t] = _py[point[t] + i] + 0.5;
+	  scale[t] = 1.0/_pb[point[t] + i];
+	}
+      CounterRNG::gamma(ntoys, &rng[0], &shape[0], &scale[0], &bkg[0]);
+
+      for(int t=0; t < ntoys; t++) mean[t] = epsilon[t] * mu + bkg[t];
+      CounterRNG::poisson(ntoys, &rng[0], &mean[0], &count[0]);
+      for(int t=0; t < ntoys; t++) data[t*_nbins + i] = count[t];
+    }
+  _random = rng[ntoys-1];
+}
+
+vector<double>
+MultiPoissonGamma::asimov(double mu)
+{
+  // the gamma priors have means (x + 1/2)/a and (y + 1/2)/b
+  vector<double> N(_nbins, 0);
+  if ( _npoints == 0 ) return N;
+  for(int k=0; k < _npoints; ++k)
+    for(int i=0; i < _nbins; ++i)
+      {
+	int c = k*_nbins + i;
+	N[i] += mu * (_px[c] + 0.5) / _pa[c] + (_py[c] + 0.5) / _pb[c];
+      }
+  for(int i=0; i < _nbins; ++i) N[i] /= _npoints;
+  return N;
+}
 
 double 
 MultiPoissonGamma::operator() (std::vector<double>& N, double mu)
 {
+  return exp(logLikelihood(N, mu));
+}
+
+double 
+MultiPoissonGamma::logLikelihood(std::vector<double>& N, double mu)
+{
+  Workspace& w = WORKSPACE;
+  w.poi.assign(1, mu);
+  evaluate(N, w.poi, w.lnL, true);
+  return w.lnL[0];
+}
+
+shared_ptr<const MultiPoissonGamma::BackgroundCache> 
+MultiPoissonGamma::_background(std::vector<double>& N)
+{
+  std::lock_guard<std::mutex> lock(_cachelock);
+  if ( _cache && _cache->counts == N ) return _cache;
+
+  BackgroundCache* cache = new BackgroundCache();
+  cache->counts = N;
+
+  // no Poisson-gamma probability of n exceeds the Poisson probability
+  // of n for mean n, which bounds the sum of the remaining bins. A
+  // count that is not an integer is bounded by interpolating the 
+  // bounds of its neighbors, as is its log-probability.
+  cache->rest.resize(_nbins + 1);
+  cache->rest[_nbins] = 0;
+  for(int i=_nbins-1; i >= 0; --i)
+    {
+      int    n0 = (int)floor(N[i]);
+      double f  = N[i] - n0;
+      double bound = 0;
+      for(int j=0; j < 2; ++j)
+	{
+	  double n = n0 + j;
+	  double w = j == 0 ? 1 - f : f;
+	  if ( w == 0 ) continue;
+	  bound += w * (-TMath::LnGamma(n+1) + (n > 0 ? n * log(n) - n : 0));
+	}
+      cache->rest[i] = cache->rest[i+1] + bound;
+    }
+  cache->offset.resize(_nbins);
+  cache->rowsize = 0;
+  for(int i=0; i < _nbins; ++i)
+    {
+      cache->offset[i] = cache->rowsize;
+      cache->rowsize += (int)ceil(N[i]) + 1;
+    }
+  // if the coefficients do not fit, they are computed as needed
+  if ( (size_t)_npoints * cache->rowsize <= MAXCACHE )
+    {
+      cache->C2.resize((size_t)_npoints * cache->rowsize);
+      for(int k=0; k < _npoints; ++k)
+	for(int i=0; i < _nbins; ++i)
+	  {
+	    int c = k*_nbins + i;
+	    MultiPoissonGammaModel::
+	      backgroundCoefficients((int)ceil(N[i]), _py[c], _pb[c],
+				     &cache->C2[k*cache->rowsize + 
+						cache->offset[i]]);
+	  }
+    }
+  _cache.reset(cache);
+  return _cache;
+}
+
+void
+MultiPoissonGamma::evaluate(std::vector<double>& N, 
+			    std::vector<double>& mu,
+			    std::vector<double>& result, 
+			    bool uselog)
+{
+  if ( (int)N.size() != _nbins )
+    {
+      Error("MultiPoissonGamma",
+	    "input vector size != %d bins", _nbins);
+      exit(0);
+    }
+  
   int first = 0;
-  int last  = _model.size()-1;
+  int last  = _npoints-1;
   if ( _index >= 0 )
     {
       first = _index;
       last  = _index;
     }
   int nconstants = 1 + last - first;
+  int nmu = (int)mu.size();
+
+  result.resize(nmu);
+  for(int j=0; j < nmu; ++j) result[j] = -HUGE_VAL;
+  
+  shared_ptr<const BackgroundCache> cache = _background(N);
 
-  double likelihood = 0.0;
-  if ( _profile )
+  if ( _profile && nconstants > 1 )
     {
-      // do something!
+      // maximize, rather than average, the likelihood over the swarm
+      for(int j=0; j < nmu; ++j)
+	{
+	  int kbest;
+	  result[j] = _profileLogLikelihood(N, mu[j], *cache, kbest);
+	}
     }
   else
     {
+      // log-sum-exp with a running maximum for each value of mu
+      Workspace& w = WORKSPACE;
+      w.lnmax.assign(nmu, -HUGE_VAL);
+      w.sum.assign(nmu, 0.0);
+      vector<double>& lnmax = w.lnmax;
+      vector<double>& sum   = w.sum;
       for(int ii=first; ii <= last; ++ii)
 	{
-	  double p = _model[ii](N, mu);
-	  likelihood += p;
+	  for(int j=0; j < nmu; ++j)
+	    {
+	      double lnp = _pointLogLikelihood(N, mu[j], ii, *cache, -HUGE_VAL);
+	      if ( lnp > lnmax[j] )
+		{
+		  sum[j]   = sum[j] * exp(lnmax[j] - lnp) + 1;
+		  lnmax[j] = lnp;
+		}
+	      else if ( lnp > -HUGE_VAL )
+		sum[j] += exp(lnp - lnmax[j]);
+	    }
 	}
-      likelihood /= nconstants;
+      for(int j=0; j < nmu; ++j)
+	if ( sum[j] > 0 ) 
+	  result[j] = lnmax[j] + log(sum[j] / nconstants);
     }
-  return likelihood;
+
+  if ( ! uselog )
+    for(int j=0; j < nmu; ++j) result[j] = exp(result[j]);
+}
+
+double
+MultiPoissonGamma::_profileLogLikelihood(std::vector<double>& N, double mu,
+					 const BackgroundCache& cache,
+					 int& kbest)
+{
+  // Start from the point at the last maximum, which is likely to be
+  // close to the maximum for nearby values of mu. A point is abandoned
+  // as soon as its partial sum over bins, plus a bound on the sum over
+  // the remaining bins, falls below the current maximum.
+  kbest = min((int)_argmax, _npoints-1);
+  double best  = _pointLogLikelihood(N, mu, kbest, cache, -HUGE_VAL);
+  double bound = best - 1.e-9 * (1 + abs(best));
+  for(int ii=0; ii < _npoints; ++ii)
+    {
+      if ( ii == kbest ) continue;
+      double lnp = _pointLogLikelihood(N, mu, ii, cache, bound);
+      if ( lnp > best )
+	{
+	  best  = lnp;
+	  kbest = ii;
+	  bound = best - 1.e-9 * (1 + abs(best));
+	}
+    }
+  _argmax = kbest;
+  return best;
+}
+
+double
+MultiPoissonGamma::_pointDerivatives(std::vector<double>& N, double mu,
+				     int k, const BackgroundCache& cache,
+				     double& d1, double& d2)
+{
+  const double* x = _px + k*_nbins;
+  const double* a = _pa + k*_nbins;
+  const double* y = _py + k*_nbins;
+  const double* b = _pb + k*_nbins;
+  const long double* C2 = cache.C2.empty() ? 0 : &cache.C2[k*cache.rowsize];
+
+  double lnp = 0;
+  d1 = d2 = 0;
+  for(int i=0; i < _nbins; ++i)
+    {
+      double g, h;
+      lnp += MultiPoissonGammaModel::
+	logProbability(N[i], mu, x[i], a[i], y[i], b[i], g, h,
+		       C2 ? C2 + cache.offset[i] : 0);
+      d1 += g;
+      d2 += h;
+    }
+  return lnp;
+}
+
+bool
+MultiPoissonGamma::derivatives(std::vector<double>& N, double mu,
+			       double& lnL, double& d1, double& d2)
+{
+  if ( (int)N.size() != _nbins )
+    {
+      Error("MultiPoissonGamma",
+	    "input vector size != %d bins", _nbins);
+      exit(0);
+    }
+  lnL = -HUGE_VAL;
+  d1 = d2 = 0;
+  int first = 0;
+  int last  = _npoints-1;
+  if ( _index >= 0 )
+    {
+      first = _index;
+      last  = _index;
+    }
+  int nconstants = 1 + last - first;
+  if ( nconstants <= 0 ) return true;
+
+  shared_ptr<const BackgroundCache> cache = _background(N);
+  if ( _profile && nconstants > 1 )
+    {
+      // the derivatives of the maximum are those of the point at the
+      // maximum
+      int k;
+      _profileLogLikelihood(N, mu, *cache, k);
+      lnL = _pointDerivatives(N, mu, k, *cache, d1, d2);
+      return true;
+    }
+  
+  // average the derivatives of the points weighted by their
+  // likelihoods (see MultiPoisson::derivatives)
+  double lnmax = -HUGE_VAL;
+  double sum0 = 0, sum1 = 0, sum2 = 0;
+  for(int ii=first; ii <= last; ++ii)
+    {
+      double g, h;
+      double lnp = _pointDerivatives(N, mu, ii, *cache, g, h);
+      if ( lnp == -HUGE_VAL ) continue;
+      if ( lnp > lnmax )
+	{
+	  double scale = exp(lnmax - lnp);
+	  sum0 *= scale;
+	  sum1 *= scale;
+	  sum2 *= scale;
+	  lnmax = lnp;
+	}
+      double w = exp(lnp - lnmax);
+      sum0 += w;
+      sum1 += w * g;
+      sum2 += w * (h + g * g);
+    }
+  if ( sum0 > 0 )
+    {
+      lnL = lnmax + log(sum0 / nconstants);
+      d1  = sum1 / sum0;
+      d2  = sum2 / sum0 - d1 * d1;
+    }
+  return true;
+}
+
+double
+MultiPoissonGamma::_pointLogLikelihood(std::vector<double>& N, double mu,
+				       int k, const BackgroundCache& cache,
+				       double bound)
+{
+  const double* x = _px + k*_nbins;
+  const double* a = _pa + k*_nbins;
+  const double* y = _py + k*_nbins;
+  const double* b = _pb + k*_nbins;
+  const long double* C2 = cache.C2.empty() ? 0 : &cache.C2[k*cache.rowsize];
+
+  // give up as soon as the remaining bins cannot raise the sum above
+  // the bound
+  double lnp = 0;
+  for(int i=0; i < _nbins; ++i)
+    {
+      lnp += MultiPoissonGammaModel::
+	logProbability(N[i], mu, x[i], a[i], y[i], b[i],
+		       C2 ? C2 + cache.offset[i] : 0);
+      if ( lnp + cache.rest[i+1] < bound ) return -HUGE_VAL;
+    }
+  return lnp;
 }
 
 void 
-MultiPoissonGamma::setSeed(int seed) { _random.SetSeed(seed); }
+MultiPoissonGamma::setSeed(int seed) 
+{ 
+  _random.setSeed(seed);
+}
+
+void 
+MultiPoissonGamma::setStream(long stream) 
+{ 
+  _random.setStream(stream);
+}
 
 double 
 MultiPoissonGamma::operator() (double mu)
@@ -568,6 +970,12 @@ MultiPoissonGamma::operator() (double mu)
   return (*this)(_N, mu);
 }
 
+double 
+MultiPoissonGamma::logLikelihood(double mu)
+{
+  return logLikelihood(_N, mu);
+}
+
 void MultiPoissonGamma::_convert(vector<double>& sig, vector<double>& dsig,
 				 vector<double>& x, vector<double>& a)
 {
@@ -15,10 +15,100 @@
 //--------------------------------------------------------------
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 #include "TError.h"
 #include "MultiPoissonGammaModel.h"
 
 using namespace std;
+
+namespace {
+  // largest second-order correction for which the saddle-point
+  // approximation is used; the relative error is then ~< 1e-6
+  const double SADDLEPOINT_TOLERANCE=1.e-3;
+
+  // Workspace for the coefficients. There is one per thread, sized
+  // to the largest count seen by that thread, so once it has grown
+  // the likelihood is computed without allocating memory.
+  thread_local vector<long double> SCRATCH;
+
+  // Compute the log of the probability of count n for the sum of two 
+  // negative binomial variates, with shapes r[i] and success 
+  // probabilities q[i], using the saddle-point approximation.
+  // Return false if the approximation is not accurate enough, though
+  // lnp is set in any case.
+  bool saddlePoint(double n, const double* r, const double* q, 
+		   double& lnp)
+  {
+    // the cumulant generating function,
+    //   K(t) = sum_i r_i [ln(1 - q_i) - ln(1 - q_i e^t)],
+    // is singular at t = -ln(max q_i). Solving for the dominant term
+    // alone gives an upper bound on the root of K'(t) = n, from which
+    // Newton's method converges monotonically since K' is convex.
+    double qmax = max(q[0], q[1]);
+    double rmax = 0;
+    for(int i=0; i < 2; i++) if ( q[i] == qmax ) rmax += r[i];
+    double t = log(n / ((n + rmax) * qmax));
+
+    double K1=0, K2=0, K3=0, K4=0;
+    for(int iter=0; iter < 100; iter++)
+      {
+	K1 = K2 = K3 = K4 = 0;
+	for(int i=0; i < 2; i++)
+	  {
+	    if ( q[i] <= 0 ) continue;
+	    double w = q[i] * exp(t);
+	    double u = w / (1 - w);
+	    double v = u * (1 + u);
+	    K1 += r[i] * u;
+	    K2 += r[i] * v;
+	    K3 += r[i] * v * (1 + 2*u);
+	    K4 += r[i] * v * (1 + 6*u*(1 + u));
+	  }
+	double dt = (K1 - n) / K2;
+	t -= dt;
+	if ( fabs(dt) < 1.e-13 * (1 + fabs(t)) ) break;
+      }
+    
+    double rho3 = K3 / pow(K2, 1.5);
+    double rho4 = K4 / (K2 * K2);
+    double correction = rho4/8 - 5*rho3*rho3/24;
+
+    double K = 0;
+    for(int i=0; i < 2; i++)
+      {
+	if ( q[i] <= 0 ) continue;
+	K += r[i] * (log1p(-q[i]) - log1p(-q[i] * exp(t)));
+      }
+    lnp = K - t*n - 0.5*log(2*M_PI*K2) + log1p(correction);
+    return fabs(correction) <= SADDLEPOINT_TOLERANCE;
+  }
+
+  // Compute the saddle-point approximation at sigma and its first
+  // and second derivatives, from a parabola through three points 
+  // spaced by a small fraction of the uncertainty in sigma.
+  bool saddlePoint(double n, double sigma, double x, double a, 
+		   double y, double b,
+		   double& lnp, double& d1, double& d2)
+  {
+    double r[2] = {x + 0.5, y + 0.5};
+    double q[2] = {0, 1 / (1 + b)};
+    q[0] = (sigma / a) / (1 + sigma / a);
+    if ( ! saddlePoint(n, r, q, lnp) ) return false;
+    
+    double h  = 1.e-3 * sqrt(n) * a / r[0];
+    double s0 = max(sigma - h, 0.0);
+    double f[3];
+    for(int i=0; i < 3; i++)
+      {
+	double s = s0 + i * h;
+	q[0] = (s / a) / (1 + s / a);
+	saddlePoint(n, r, q, f[i]);
+      }
+    d2 = (f[2] - 2 * f[1] + f[0]) / (h * h);
+    d1 = (f[2] - f[0]) / (2 * h) + d2 * (sigma - s0 - h);
+    return true;
+  }
+};
 //--------------------------------------------------------------
 MultiPoissonGammaModel::MultiPoissonGammaModel()
   : PDFunction(),
@@ -28,7 +118,8 @@ MultiPoissonGammaModel::MultiPoissonGammaModel()
     _y(vector<double>()),
     _b(vector<double>()),
     _maxcount(100000),
-    _gslRan(new ROOT::Math::Random<ROOT::Math::GSLRngMT>())
+    _saddlecount(1000),
+    _random(CounterRNG())
 {}
 
 MultiPoissonGammaModel::MultiPoissonGammaModel(vector<double>& data,
@@ -44,7 +135,8 @@ MultiPoissonGammaModel::MultiPoissonGammaModel(vector<double>& data,
     _y(y),
     _b(vector<double>(x.size(), b)),
     _maxcount(maxcount),
-    _gslRan(new ROOT::Math::Random<ROOT::Math::GSLRngMT>())
+    _saddlecount(1000),
+    _random(CounterRNG())
 {
 }
 
@@ -61,7 +153,8 @@ MultiPoissonGammaModel::MultiPoissonGammaModel(vector<double>& data,
     _y(y),
     _b(b),
     _maxcount(maxcount),
-    _gslRan(new ROOT::Math::Random<ROOT::Math::GSLRngMT>())
+    _saddlecount(1000),
+    _random(CounterRNG())
 {
   if(_x.size() != _b.size() ||
      _x.size() != _a.size() ||
@@ -86,12 +179,57 @@ MultiPoissonGammaModel::MultiPoissonGammaModel(double data,
     _y(vector<double>(1, y)),
     _b(vector<double>(1, b)),
     _maxcount(maxcount),
-    _gslRan(new ROOT::Math::Random<ROOT::Math::GSLRngMT>())
+    _saddlecount(1000),
+    _random(CounterRNG())
 {
 }
 
+MultiPoissonGammaModel::MultiPoissonGammaModel(const MultiPoissonGammaModel& o)
+  : PDFunction(),
+    _data(o._data),
+    _x(o._x),
+    _a(o._a),
+    _y(o._y),
+    _b(o._b),
+    _maxcount(o._maxcount),
+    _saddlecount(o._saddlecount),
+    _random(o._random),
+    _cache(o._cache)
+{
+}
+
+MultiPoissonGammaModel& 
+MultiPoissonGammaModel::operator=(const MultiPoissonGammaModel& o)
+{
+  if ( this == &o ) return *this;
+  _data = o._data;
+  _x = o._x;
+  _a = o._a;
+  _y = o._y;
+  _b = o._b;
+  _maxcount = o._maxcount;
+  _saddlecount = o._saddlecount;
+  _random = o._random;
+  std::lock_guard<std::mutex> lock(_cachelock);
+  _cache = o._cache;
+  return *this;
+}
+
 MultiPoissonGammaModel::~MultiPoissonGammaModel() 
-{}
+{
+}
+
+void
+MultiPoissonGammaModel::setSeed(int seed)
+{
+  _random.setSeed(seed);
+}
+
+void
+MultiPoissonGammaModel::setStream(long stream)
+{
+  _random.setStream(stream);
+}
 
 vector<double>&  
 MultiPoissonGammaModel::generate(double sigma)
@@ -105,36 +243,90 @@ MultiPoissonGammaModel::generate(double sigma)
       
   for(size_t ibin=0; ibin < _x.size(); ++ibin)
     {
-      double epsilon = _gslRan->Gamma(_x[ibin]+0.5, 1.0/_a[ibin]);
+      double epsilon = _random.gamma(_x[ibin]+0.5, 1.0/_a[ibin]);
       //cout << "epsilon " << epsilon << endl;
             
-      double mu      = _gslRan->Gamma(_y[ibin]+0.5, 1.0/_b[ibin]);
+      double mu      = _random.gamma(_y[ibin]+0.5, 1.0/_b[ibin]);
       //cout << "mu      " << mu << endl;
       
       double mean    = epsilon * sigma + mu;
       //cout << "mean    " << mean << endl;
       
-      _data[ibin]    = _gslRan->Poisson(mean);
+      _data[ibin]    = _random.poisson(mean);
       //cout << "data  = " << _data[ibin] << endl;
     }
   return _data;
 }
 
-double 
-MultiPoissonGammaModel::operator() (std::vector<double>& data, double sigma)
+void
+MultiPoissonGammaModel::generateBatch(double sigma, int ntoys, 
+				      vector<double>& data, long firststream)
 {
-  if(data.size() != _x.size())
+  if((int)_x.size() == 0)
     {
       Error("MultiPoissonGammaModel",
-	    "input vector size != %d bins", (int)_x.size());
+	    "required input vectors not supplied by user.");
       exit(0);
     }
-  long double C1[_maxcount+1];
-  long double C2[_maxcount+1];
-    
-  // loop over bins
-  long double prob = 1.0;    
+  int nbins = (int)_x.size();
+  data.resize(ntoys > 0 ? ntoys * nbins : 0);
+  if ( ntoys <= 0 ) return;
+
+  // one generator per toy, each drawing its numbers in the same order
+  // as generate
+  vector<CounterRNG> rng(ntoys);
+  for(int t=0; t < ntoys; t++) 
+    rng[t] = CounterRNG(_random.seed(), firststream + t);
+
+  vector<double> shape(ntoys), scale(ntoys);
+  vector<double> epsilon(ntoys), mu(ntoys), mean(ntoys), count(ntoys);
+  for(int ibin=0; ibin < nbins; ++ibin)
+    {
+      fill(shape.begin(), shape.end(), _x[ibin]+0.5);
+      fill(scale.begin(), scale.end(), 1.0/_a[ibin]);
+      CounterRNG::gamma(ntoys, &rng[0], &shape[0], &scale[0], &epsilon[0]);
+
+      fill(shape.begin(), shape.end(), _y[ibin]+0.5);
+      fill(scale.begin(), scale.end(), 1.0/_b[ibin]);
+      CounterRNG::gamma(ntoys, &rng[0], &shape[0], &scale[0], &mu[0]);
+
+      for(int t=0; t < ntoys; t++) mean[t] = epsilon[t] * sigma + mu[t];
+      CounterRNG::poisson(ntoys, &rng[0], &mean[0], &count[0]);
+      for(int t=0; t < ntoys; t++) data[t*nbins + ibin] = count[t];
+    }
+  _random = rng[ntoys-1];
+}
+
+vector<double>
+MultiPoissonGammaModel::asimov(double sigma)
+{
+  vector<double> data(_x.size());
   for(size_t ibin=0; ibin < _x.size(); ++ibin)
+    {
+      double mean = sigma * (_x[ibin]+0.5) / _a[ibin] 
+	+ (_y[ibin]+0.5) / _b[ibin];
+      data[ibin] = mean;
+    }
+  return data;
+}
+
+double 
+MultiPoissonGammaModel::operator() (std::vector<double>& data, double sigma)
+{
+  return exp(logLikelihood(data, sigma));
+}
+
+shared_ptr<const MultiPoissonGammaModel::BackgroundCache> 
+MultiPoissonGammaModel::_background(std::vector<double>& data)
+{
+  std::lock_guard<std::mutex> lock(_cachelock);
+  if ( _cache && _cache->counts == data ) return _cache;
+
+  BackgroundCache* cache = new BackgroundCache();
+  cache->counts = data;
+  cache->offset.resize(data.size());
+  int size = 0;
+  for(size_t ibin=0; ibin < data.size(); ++ibin)
     {
       double nn = data[ibin];    // observed count	  
       if ( nn > _maxcount )
@@ -145,35 +337,244 @@ MultiPoissonGammaModel::operator() (std::vector<double>& data, double sigma)
                 (int)ibin, (int)nn, _maxcount);
           exit(0);
 	}
-      
-      double p1 = sigma / _a[ibin];
-      double p2 = 1.0 / _b[ibin];
-      double A1 = _x[ibin]-0.5;  // signal count
-      double A2 = _y[ibin]-0.5;  // background count
-
-      // compute coefficients
-      C1[0] = pow(1+p1, -(A1+1));
-      C2[0] = pow(1+p2, -(A2+1));
-      double dk;	  
-      if ( nn > 0 )
+      cache->offset[ibin] = size;
+      size += (int)ceil(nn) + 1;
+    }
+  cache->C2.resize(size);
+
+  // the coefficients for count n are the first n+1 of those for any
+  // larger count, so ceil(n) covers both neighbors of a count that 
+  // is not an integer
+  for(size_t ibin=0; ibin < data.size(); ++ibin)
+    backgroundCoefficients((int)ceil(data[ibin]), _y[ibin], _b[ibin],
+			   &cache->C2[cache->offset[ibin]]);
+  _cache.reset(cache);
+  return _cache;
+}
+
+double 
+MultiPoissonGammaModel::logLikelihood(std::vector<double>& data, double sigma)
+{
+  if(data.size() != _x.size())
+    {
+      Error("MultiPoissonGammaModel",
+	    "input vector size != %d bins", (int)_x.size());
+      exit(0);
+    }
+  shared_ptr<const BackgroundCache> cache = _background(data);
+    
+  // loop over bins
+  double lnprob = 0.0;
+  for(size_t ibin=0; ibin < _x.size(); ++ibin)
+    lnprob += logProbability(data[ibin], sigma, 
+			     _x[ibin], _a[ibin], _y[ibin], _b[ibin],
+			     &cache->C2[cache->offset[ibin]],
+			     _saddlecount);
+  return lnprob;
+}
+
+void
+MultiPoissonGammaModel::backgroundCoefficients(int n, double y, double b,
+					       long double* C2)
+{
+  double p2 = 1.0 / b;
+  double A2 = y-0.5;  // background count
+  C2[0] = powl(1+p2, -(A2+1));
+  for(int ik=1; ik <= n; ++ik)
+    {
+      double dk = (double)ik;
+      C2[ik] = C2[ik-1] * (p2/(1+p2)) * (A2+dk)/dk;
+    }
+}
+
+double
+MultiPoissonGammaModel::logProbability(double n, double sigma,
+				       double x, double a,
+				       double y, double b,
+				       const long double* C2,
+				       int saddlecount)
+{
+  int    n0 = (int)floor(n);
+  double f  = n - n0;
+  double lnp0 = _logProbability(n0, sigma, x, a, y, b, C2, saddlecount);
+  if ( f == 0 ) return lnp0;
+  double lnp1 = _logProbability(n0+1, sigma, x, a, y, b, C2, saddlecount);
+  return (1 - f) * lnp0 + f * lnp1;
+}
+
+double
+MultiPoissonGammaModel::logProbability(double n, double sigma,
+				       double x, double a,
+				       double y, double b,
+				       double& d1, double& d2,
+				       const long double* C2,
+				       int saddlecount)
+{
+  int    n0 = (int)floor(n);
+  double f  = n - n0;
+  double lnp0 = _logProbability(n0, sigma, x, a, y, b, d1, d2, 
+				C2, saddlecount);
+  if ( f == 0 ) return lnp0;
+  double g, h;
+  double lnp1 = _logProbability(n0+1, sigma, x, a, y, b, g, h, 
+				C2, saddlecount);
+  d1 = (1 - f) * d1 + f * g;
+  d2 = (1 - f) * d2 + f * h;
+  return (1 - f) * lnp0 + f * lnp1;
+}
+
+double
+MultiPoissonGammaModel::_logProbability(int nn, double sigma,
+					double x, double a,
+					double y, double b,
+					const long double* C2,
+					int saddlecount)
+{
+  double p1 = sigma / a;
+  double A1 = x-0.5;  // signal count
+
+  bool saddle = nn > 0 && nn >= saddlecount;
+  double lnp = 0;
+  if ( saddle )
+    {
+      double r[2] = {A1 + 1, y + 0.5};
+      double q[2] = {p1 / (1 + p1), 1 / (1 + b)};
+      if ( saddlePoint(nn, r, q, lnp) ) return lnp;
+    }
+
+  // workspace for the coefficients
+  size_t size = C2 ? nn + 1 : 2 * (nn + 1);
+  if ( SCRATCH.size() < size ) SCRATCH.resize(size);
+  long double* C1 = &SCRATCH[0];
+  if ( C2 == 0 )
+    {
+      backgroundCoefficients(nn, y, b, &SCRATCH[nn+1]);
+      C2 = &SCRATCH[nn+1];
+    }
+  
+  // compute coefficients
+  C1[0] = powl(1+p1, -(A1+1));
+  double dk;	  
+  for(int ik=1; ik <= nn; ++ik)
+    {
+      dk = (double)ik;
+      C1[ik] = C1[ik-1] * (p1/(1+p1)) * (A1+dk)/dk;
+    }
+  
+  // compute p(nn|sigma)
+  long double sum = 0.0;  
+  for (int ik=0; ik <= nn; ++ik)
+    {
+      sum += C1[ik] * C2[nn-ik];
+    }	  
+  // for large counts the coefficients can underflow, in which
+  // case the saddle-point approximation is the better estimate
+  if ( sum > 0 || !saddle ) lnp = log(sum);
+  return lnp;
+}
+
+double
+MultiPoissonGammaModel::_logProbability(int nn, double sigma,
+					double x, double a,
+					double y, double b,
+					double& d1, double& d2,
+					const long double* C2,
+					int saddlecount)
+{
+  d1 = d2 = 0;
+  double p1 = sigma / a;
+  double A1 = x-0.5;  // signal count
+
+  bool saddle = nn > 0 && nn >= saddlecount;
+  double lnp = 0;
+  if ( saddle && saddlePoint(nn, sigma, x, a, y, b, lnp, d1, d2) ) 
+    return lnp;
+  
+  size_t size = C2 ? nn + 1 : 2 * (nn + 1);
+  if ( SCRATCH.size() < size ) SCRATCH.resize(size);
+  long double* C1 = &SCRATCH[0];
+  if ( C2 == 0 )
+    {
+      backgroundCoefficients(nn, y, b, &SCRATCH[nn+1]);
+      C2 = &SCRATCH[nn+1];
+    }
+  C1[0] = powl(1+p1, -(A1+1));
+  for(int ik=1; ik <= nn; ++ik)
+    {
+      double dk = (double)ik;
+      C1[ik] = C1[ik-1] * (p1/(1+p1)) * (A1+dk)/dk;
+    }
+
+  // The derivative of ln C1[k] with respect to sigma is
+  //   u_k = [k / p1 - (A1 + 1 + k) / (1 + p1)] / a,
+  // so that, averaging over the terms of the convolution,
+  //   d ln p / d sigma   = <u>, and
+  //   d2 ln p / d sigma2 = <u^2 + du/dsigma> - <u>^2.
+  long double sum = 0, sum1 = 0, sum2 = 0;
+  for (int ik=0; ik <= nn; ++ik)
+    {
+      long double t = C1[ik] * C2[nn-ik];
+      if ( t == 0 ) continue;
+      double u  = -(A1 + 1 + ik) / (1 + p1);
+      double du =  (A1 + 1 + ik) / ((1 + p1) * (1 + p1));
+      if ( ik > 0 )
 	{
-          for(int ik=1; ik <= (int)nn; ++ik)
-	    {
-              dk = (double)ik;
-              C1[ik] = C1[ik-1] * (p1/(1+p1)) * (A1+dk)/dk;
-              C2[ik] = C2[ik-1] * (p2/(1+p2)) * (A2+dk)/dk;
-	    }
+	  u  += ik / p1;
+	  du -= ik / (p1 * p1);
 	}
-	  
-      // compute p(nn|sigma)
-      long double sum = 0.0;  
-      for (int ik=0; ik <= (int)nn; ++ik)
-	{
-          sum += C1[ik] * C2[(int)nn-ik];
-	}	  
-      prob *= sum; // product of likelihood over bins	  
-    } // loop over bins
-  return (double)prob;
+      u  /= a;
+      du /= a * a;
+      sum  += t;
+      sum1 += t * u;
+      sum2 += t * (u * u + du);
+    }
+  if ( p1 == 0 && sum > 0 )
+    {
+      // only C1[0], C1[1] and C1[2] have non-zero derivatives at
+      // sigma = 0, which are, with respect to p1, -c, c and 0, and
+      // c(c+1), -2c(c+1) and c(c+1), where c = A1 + 1
+      double c = A1 + 1;
+      long double C2n1 = nn >= 1 ? C2[nn-1] : 0;
+      long double C2n2 = nn >= 2 ? C2[nn-2] : 0;
+      sum1 = c * (C2n1 - C2[nn]) / a;
+      sum2 = c * (c + 1) * (C2[nn] - 2 * C2n1 + C2n2) / (a * a);
+    }
+  if ( sum > 0 )
+    {
+      double mean = sum1 / sum;
+      d1  = mean;
+      d2  = sum2 / sum - mean * mean;
+      lnp = log(sum);
+    }
+  else if ( ! saddle )
+    lnp = log(sum);
+  return lnp;
+}
+
+bool
+MultiPoissonGammaModel::derivatives(std::vector<double>& data, double sigma,
+				    double& lnL, double& d1, double& d2)
+{
+  if(data.size() != _x.size())
+    {
+      Error("MultiPoissonGammaModel",
+	    "input vector size != %d bins", (int)_x.size());
+      exit(0);
+    }
+  shared_ptr<const BackgroundCache> cache = _background(data);
+  
+  lnL = d1 = d2 = 0;
+  for(size_t ibin=0; ibin < _x.size(); ++ibin)
+    {
+      double g, h;
+      lnL += logProbability(data[ibin], sigma, 
+			    _x[ibin], _a[ibin], _y[ibin], _b[ibin], g, h,
+			    &cache->C2[cache->offset[ibin]],
+			    _saddlecount);
+      d1 += g;
+      d2 += h;
+    }
+  return true;
 }
 
 double 
@@ -181,3 +582,9 @@ MultiPoissonGammaModel::operator() (double sigma)
 {
   return (*this)(_data, sigma);
 }
+
+double 
+MultiPoissonGammaModel::logLikelihood(double sigma)
+{
+  return logLikelihood(_data, sigma);
+}
@@ -72,4 +72,47 @@ PDFWrapper::operator() (std::vector<double>& data, double poi)
     }
   return _pdf->getVal();
 }
+
+double 
+PDFWrapper::logLikelihood(std::vector<double>& data, double poi)
+{
+  if ( (int)data.size() == 0 ) return -HUGE_VAL;
+  if ( (int)data.size() != (int)_data.size() ) return -HUGE_VAL;
+  
+  _poi->setVal(poi);
+  for(unsigned int i=0; i < data.size(); i++)
+    {
+      _data[i] = data[i];
+      RooRealVar* v = (RooRealVar*)(&_list[i]);
+      v->setVal(_data[i]);
+    }
+  return _pdf->getLogVal();
+}
+
+void
+PDFWrapper::evaluate(std::vector<double>& data, 
+		     std::vector<double>& poi,
+		     std::vector<double>& result, 
+		     bool uselog)
+{
+  result.resize(poi.size());
+  if ( (int)data.size() == 0 || (int)data.size() != (int)_data.size() )
+    {
+      for(unsigned int j=0; j < poi.size(); j++)
+	result[j] = uselog ? -HUGE_VAL : 0;
+      return;
+    }
+  
+  for(unsigned int i=0; i < data.size(); i++)
+    {
+      _data[i] = data[i];
+      RooRealVar* v = (RooRealVar*)(&_list[i]);
+      v->setVal(_data[i]);
+    }
+  for(unsigned int j=0; j < poi.size(); j++)
+    {
+      _poi->setVal(poi[j]);
+      result[j] = uselog ? _pdf->getLogVal() : _pdf->getVal();
+    }
+}
 #endif
@@ -19,6 +19,42 @@
 // Modifications: 
 //
 //--------------------------------------------------------------
+#include <cmath>
 #include "PDFunction.h"
 ClassImp(PDFunction)
 
+double 
+PDFunction::logLikelihood(std::vector<double>& data, double theta)
+{
+  return std::log((*this)(data, theta));
+}
+
+
+void
+PDFunction::evaluate(std::vector<double>& data, 
+		     std::vector<double>& theta,
+		     std::vector<double>& result, 
+		     bool uselog)
+{
+  result.resize(theta.size());
+  for(size_t i=0; i < theta.size(); i++)
+    {
+      result[i] = logLikelihood(data, theta[i]);
+      if ( ! uselog ) result[i] = std::exp(result[i]);
+    }
+}
+
+
+void
+PDFunction::generateBatch(double theta, int ntoys, 
+			  std::vector<double>& data,
+			  long firststream)
+{
+  data.clear();
+  for(int t=0; t < ntoys; t++)
+    {
+      setStream(firststream + t);
+      std::vector<double>& d = generate(theta);
+      data.insert(data.end(), d.begin(), d.end());
+    }
+}
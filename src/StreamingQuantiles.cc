@@ -0,0 +1,171 @@
+//--------------------------------------------------------------
+// File: StreamingQuantiles.cc
+// Description: Estimate quantiles of a stream of values, and their
+//              Monte Carlo uncertainties, in bounded memory.
+//--------------------------------------------------------------
+#include <cmath>
+#include <algorithm>
+#include "StreamingQuantiles.h"
+
+using namespace std;
+
+namespace {
+  // probabilities are kept away from the extreme markers
+  const double PMIN=1.e-6;
+
+  // quantile of sorted values, interpolated between order statistics
+  double quantile(const vector<double>& v, double p)
+  {
+    int    n = (int)v.size();
+    double q = p * n;
+    int    i = min((int)q, n-1);
+    int    j = min(i+1, n-1);
+    double x = q - i;
+    return x * v[j] + (1 - x) * v[i];
+  }
+};
+
+StreamingQuantiles::StreamingQuantiles(const vector<double>& prob,
+				       int exactsize)
+  : _prob(prob),
+    _exactsize(exactsize),
+    _count(0),
+    _index(vector<int>(prob.size()))
+{
+  // one marker at each distinct probability, one at each midpoint
+  // between them, and one at each extreme
+  vector<double> u;
+  for(size_t ii=0; ii < _prob.size(); ii++)
+    u.push_back(min(max(_prob[ii], PMIN), 1 - PMIN));
+  sort(u.begin(), u.end());
+  u.erase(unique(u.begin(), u.end()), u.end());
+
+  _p.push_back(0);
+  for(size_t ii=0; ii < u.size(); ii++)
+    {
+      _p.push_back(((ii > 0 ? u[ii-1] : 0) + u[ii]) / 2);
+      _p.push_back(u[ii]);
+    }
+  _p.push_back(((u.size() > 0 ? u.back() : 0) + 1) / 2);
+  _p.push_back(1);
+
+  for(size_t ii=0; ii < _prob.size(); ii++)
+    {
+      double p = min(max(_prob[ii], PMIN), 1 - PMIN);
+      _index[ii] = 2 * (lower_bound(u.begin(), u.end(), p) - u.begin()) + 2;
+    }
+
+  // P^2 needs at least one value per marker to start
+  _exactsize = max(_exactsize, (int)_p.size());
+  _values.reserve(min(_exactsize + 1, (int)EXACTSIZE));
+}
+
+void StreamingQuantiles::add(double x)
+{
+  _count++;
+  if ( _count <= _exactsize + 1 )
+    {
+      _values.push_back(x);
+      if ( _count > _exactsize ) _start();
+      return;
+    }
+
+  // find the cell that contains x, extending the extremes if needed
+  int M = (int)_p.size();
+  int k;
+  if ( x < _q[0] )
+    {
+      _q[0] = x;
+      k = 0;
+    }
+  else if ( x >= _q[M-1] )
+    {
+      _q[M-1] = x;
+      k = M-2;
+    }
+  else
+    k = (int)(upper_bound(_q.begin(), _q.end(), x) - _q.begin()) - 1;
+
+  for(int i=k+1; i < M; i++) _n[i]++;
+
+  // move the interior markers that are more than one position away
+  // from where they should be
+  for(int i=1; i < M-1; i++)
+    {
+      double d = 1 + (_count - 1) * _p[i] - _n[i];
+      if ( (d >=  1 && _n[i+1] - _n[i] >  1) ||
+	   (d <= -1 && _n[i-1] - _n[i] < -1) )
+	{
+	  int s = d > 0 ? 1 : -1;
+	  double q = _q[i] + s / (_n[i+1] - _n[i-1]) *
+	    ((_n[i] - _n[i-1] + s) * (_q[i+1] - _q[i]) / (_n[i+1] - _n[i]) +
+	     (_n[i+1] - _n[i] - s) * (_q[i] - _q[i-1]) / (_n[i] - _n[i-1]));
+
+	  // use linear interpolation if the parabola is not monotonic
+	  if ( q <= _q[i-1] || q >= _q[i+1] )
+	    q = _q[i] + s * (_q[i+s] - _q[i]) / (_n[i+s] - _n[i]);
+	  _q[i] = q;
+	  _n[i] += s;
+	}
+    }
+}
+
+vector<double> StreamingQuantiles::quantiles() const
+{
+  vector<double> q = _markers();
+  vector<double> result(_prob.size());
+  for(size_t ii=0; ii < _prob.size(); ii++) result[ii] = q[_index[ii]];
+  return result;
+}
+
+vector<double> StreamingQuantiles::errors() const
+{
+  vector<double> result(_prob.size(), HUGE_VAL);
+  if ( _count < 2 ) return result;
+
+  vector<double> q = _markers();
+  for(size_t ii=0; ii < _prob.size(); ii++)
+    {
+      int j = _index[ii];
+      double p = _p[j];
+      double dqdp = (q[j+1] - q[j-1]) / (_p[j+1] - _p[j-1]);
+      result[ii] = sqrt(p * (1 - p) / _count) * dqdp;
+    }
+  return result;
+}
+
+void StreamingQuantiles::_start()
+{
+  // place the markers at the order statistics nearest to their
+  // desired positions, keeping the positions distinct
+  sort(_values.begin(), _values.end());
+  int N = (int)_values.size();
+  int M = (int)_p.size();
+  _q = vector<double>(M);
+  _n = vector<double>(M);
+  for(int i=0; i < M; i++)
+    {
+      int pos = (int)floor(1 + (N - 1) * _p[i] + 0.5);
+      if ( i > 0 ) pos = max(pos, (int)_n[i-1] + 1);
+      _n[i] = pos;
+    }
+  for(int i=M-1; i >= 0; i--)
+    {
+      _n[i] = min(_n[i], (double)(N - (M - 1 - i)));
+      _q[i] = _values[(int)_n[i] - 1];
+    }
+  vector<double>().swap(_values);
+}
+
+vector<double> StreamingQuantiles::_markers() const
+{
+  if ( ! exact() ) return _q;
+
+  vector<double> q(_p.size(), 0);
+  if ( _count == 0 ) return q;
+
+  vector<double> v(_values);
+  sort(v.begin(), v.end());
+  for(size_t i=0; i < _p.size(); i++) q[i] = quantile(v, _p[i]);
+  return q;
+}
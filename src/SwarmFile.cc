@@ -0,0 +1,223 @@
+//--------------------------------------------------------------
+// File: SwarmFile.cc
+// Description: Read and write swarms of sampled points in a 
+//              binary format that can be memory-mapped.
+//--------------------------------------------------------------
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "TError.h"
+#include "SwarmFile.h"
+
+using namespace std;
+
+namespace {
+  const char MAGIC[8] = {'L','I','M','S','W','A','R','M'};
+  const int  MAXSECTIONS=16;
+  const int  HEADERSIZE=512;
+  const int  ALIGNMENT=64;
+  const uint32_t ENDIAN=0x01020304;
+
+  struct Header
+  {
+    char     magic[8];
+    uint32_t version;
+    uint32_t model;
+    uint32_t dtype;                // bytes per value
+    uint32_t endian;               // ENDIAN in the writer's byte order
+    uint32_t nbins;
+    uint32_t npoints;
+    uint32_t stride;
+    uint32_t nsections;
+    uint64_t offset[MAXSECTIONS];  // byte offset of each section
+    uint64_t length[MAXSECTIONS];  // number of values in each section
+  };
+
+  uint64_t align(uint64_t n) 
+  { 
+    return ALIGNMENT * ((n + ALIGNMENT - 1) / ALIGNMENT); 
+  }
+};
+
+bool
+SwarmFile::isBinary(string filename)
+{
+  ifstream inp(filename.c_str(), ios::binary);
+  char magic[8];
+  if ( ! inp.read(magic, sizeof(magic)) ) return false;
+  return memcmp(magic, MAGIC, sizeof(magic)) == 0;
+}
+
+SwarmFile::SwarmFile(string filename, int model)
+  : _filename(filename),
+    _address(0),
+    _size(0),
+    _nbins(0),
+    _npoints(0),
+    _stride(0),
+    _sections(vector<pair<const double*, size_t> >())
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if ( fd < 0 )
+    {
+      Error("SwarmFile", "unable to open file %s", filename.c_str());
+      exit(0);
+    }
+  struct stat info;
+  if ( fstat(fd, &info) != 0 || info.st_size < HEADERSIZE )
+    {
+      Error("SwarmFile", "file %s is too short", filename.c_str());
+      exit(0);
+    }
+  _size = info.st_size;
+  _address = mmap(0, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if ( _address == MAP_FAILED )
+    {
+      Error("SwarmFile", "unable to map file %s", filename.c_str());
+      exit(0);
+    }
+
+  const Header* header = (const Header*)_address;
+  if ( memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+       header->endian != ENDIAN )
+    {
+      Error("SwarmFile", "%s is not a swarm file for this machine",
+	    filename.c_str());
+      exit(0);
+    }
+  if ( header->version != VERSION )
+    {
+      Error("SwarmFile", "%s has version %d; expected version %d",
+	    filename.c_str(), (int)header->version, (int)VERSION);
+      exit(0);
+    }
+  if ( (int)header->model != model )
+    {
+      Error("SwarmFile", "%s was written by a different model",
+	    filename.c_str());
+      exit(0);
+    }
+  if ( header->dtype != sizeof(double) || 
+       header->nsections > (uint32_t)MAXSECTIONS )
+    {
+      Error("SwarmFile", "%s has an unsupported layout",
+	    filename.c_str());
+      exit(0);
+    }
+  if ( header->nbins == 0 || header->nbins > (uint32_t)INT32_MAX || 
+       header->npoints > (uint32_t)INT32_MAX ||
+       header->stride > (uint32_t)INT32_MAX )
+    {
+      Error("SwarmFile", "%s has an invalid number of bins or points",
+	    filename.c_str());
+      exit(0);
+    }
+  _nbins   = header->nbins;
+  _npoints = header->npoints;
+  _stride  = header->stride;
+  
+  for(uint32_t i=0; i < header->nsections; i++)
+    {
+      // written so that a corrupt offset or length cannot overflow
+      uint64_t offset = header->offset[i];
+      if ( offset < (uint64_t)HEADERSIZE || offset % ALIGNMENT != 0 ||
+	   offset > _size ||
+	   header->length[i] > (_size - offset) / sizeof(double) )
+	{
+	  Error("SwarmFile", "%s is truncated", filename.c_str());
+	  exit(0);
+	}
+      const double* p = (const double*)((char*)_address + 
+					header->offset[i]);
+      _sections.push_back(pair<const double*, size_t>(p, 
+						      header->length[i]));
+    }
+}
+
+SwarmFile::~SwarmFile()
+{
+  if ( _address ) munmap(_address, _size);
+}
+
+void
+SwarmFile::checkSections(const vector<size_t>& lengths) const
+{
+  if ( _sections.size() != lengths.size() )
+    {
+      Error("SwarmFile", "%s has %d sections; expected %d", 
+	    _filename.c_str(), (int)_sections.size(), (int)lengths.size());
+      exit(0);
+    }
+  for(size_t i=0; i < lengths.size(); i++)
+    if ( _sections[i].second != lengths[i] )
+      {
+	Error("SwarmFile", "section %d of %s has %lu values; expected %lu", 
+	      (int)i, _filename.c_str(), 
+	      (unsigned long)_sections[i].second, 
+	      (unsigned long)lengths[i]);
+	exit(0);
+      }
+}
+
+void
+SwarmFile::write(string filename, int model, 
+		 int nbins, int npoints, int stride,
+		 vector<pair<const double*, size_t> >& sections)
+{
+  if ( (int)sections.size() > MAXSECTIONS )
+    {
+      Error("SwarmFile", "too many sections: %d", (int)sections.size());
+      exit(0);
+    }
+  
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version   = VERSION;
+  header.model     = model;
+  header.dtype     = sizeof(double);
+  header.endian    = ENDIAN;
+  header.nbins     = nbins;
+  header.npoints   = npoints;
+  header.stride    = stride;
+  header.nsections = sections.size();
+  uint64_t offset  = HEADERSIZE;
+  for(size_t i=0; i < sections.size(); i++)
+    {
+      header.offset[i] = offset;
+      header.length[i] = sections[i].second;
+      offset = align(offset + sections[i].second * sizeof(double));
+    }
+
+  ofstream out(filename.c_str(), ios::binary);
+  if ( ! out.good() )
+    {
+      Error("SwarmFile", "unable to open file %s", filename.c_str());
+      exit(0);
+    }
+  char block[HEADERSIZE];
+  memset(block, 0, sizeof(block));
+  memcpy(block, &header, sizeof(header));
+  out.write(block, HEADERSIZE);
+
+  char zeros[ALIGNMENT];
+  memset(zeros, 0, sizeof(zeros));
+  for(size_t i=0; i < sections.size(); i++)
+    {
+      uint64_t bytes = sections[i].second * sizeof(double);
+      out.write((const char*)sections[i].first, bytes);
+      out.write(zeros, align(header.offset[i] + bytes) 
+		- (header.offset[i] + bytes));
+    }
+  if ( ! out.good() )
+    {
+      Error("SwarmFile", "error writing file %s", filename.c_str());
+      exit(0);
+    }
+}
@@ -0,0 +1,210 @@
+//--------------------------------------------------------------
+// File: SwarmReader.cc
+// Description: Read a swarm of sampled points from a text file
+//              a chunk at a time.
+//--------------------------------------------------------------
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#if defined(__has_include)
+#if __has_include(<charconv>) && __cplusplus >= 201703L
+#include <charconv>
+#endif
+#endif
+#include "TError.h"
+#include "SwarmReader.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+namespace {
+  // size of the blocks in which the file is read. The buffer grows
+  // only if a single line is longer than this.
+  const size_t BLOCKSIZE=1 << 22;
+
+  // smallest amount of text worth decoding in a separate task
+  const size_t TASKSIZE=1 << 16;
+
+  inline bool whitespace(char c)
+  {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == 0;
+  }
+
+  inline const char* parse(const char* s, const char* end, double& x)
+  {
+#if defined(__cpp_lib_to_chars)
+    if ( s < end && *s == '+' ) s++;
+    from_chars_result r = from_chars(s, end, x);
+    return r.ec == errc() ? r.ptr : 0;
+#else
+    // strtod needs a terminated string; the records always are, by
+    // a newline, a null, or the end of the buffer
+    char* e;
+    x = strtod(s, &e);
+    return e == s || e > end ? 0 : e;
+#endif
+  }
+};
+
+SwarmReader::SwarmReader(string filename)
+  : _filename(filename),
+    _stream(filename.c_str(), ios::in | ios::binary),
+    _lineno(0),
+    _buffer(vector<char>(BLOCKSIZE + 1)),
+    _begin(0),
+    _end(0),
+    _eof(false)
+{
+  if ( ! _stream.good() )
+    {
+      Error("SwarmReader", "unable to open file %s", filename.c_str());
+      exit(0);
+    }
+}
+
+SwarmReader::~SwarmReader()
+{
+}
+
+bool SwarmReader::_refill()
+{
+  if ( _eof ) return false;
+
+  // move the unread text to the start of the buffer, and make room
+  // if a line fills the whole buffer
+  size_t size = _end - _begin;
+  if ( size > 0 ) memmove(&_buffer[0], &_buffer[_begin], size);
+  _begin = 0;
+  _end   = size;
+  if ( _end + 1 >= _buffer.size() ) _buffer.resize(2 * _buffer.size());
+
+  // keep one byte for a terminating null
+  _stream.read(&_buffer[_end], _buffer.size() - 1 - _end);
+  size_t n = _stream.gcount();
+  _end += n;
+  _buffer[_end] = 0;
+  if ( n == 0 || ! _stream ) _eof = true;
+  return true;
+}
+
+bool SwarmReader::_record(const char*& begin, const char*& end)
+{
+  // return the next record already in the buffer
+  while ( _begin < _end )
+    {
+      char* line = &_buffer[_begin];
+      char* eol  = (char*)memchr(line, '\n', _end - _begin);
+      if ( eol == 0 )
+	{
+	  // the last line need not end with a newline
+	  if ( ! _eof ) return false;
+	  eol = &_buffer[_end];
+	}
+      _begin = eol - &_buffer[0] + (eol < &_buffer[_end] ? 1 : 0);
+      _lineno++;
+
+      // remove leading and trailing white space
+      while ( line < eol && whitespace(*line) ) line++;
+      char* last = eol;
+      while ( last > line && whitespace(last[-1]) ) last--;
+
+      // skip blank lines and lines that start with #
+      if ( last == line ) continue;
+      if ( *line == '#' ) continue;
+
+      begin = line;
+      end   = last;
+      return true;
+    }
+  return false;
+}
+
+bool SwarmReader::next(string& record)
+{
+  const char* begin;
+  const char* end;
+  while ( ! _record(begin, end) )
+    if ( ! _refill() ) return false;
+  record.assign(begin, end);
+  return true;
+}
+
+int SwarmReader::decode(const char* begin, const char* end, int ncolumns,
+			double* values)
+{
+  const char* s = begin;
+  int c = 0;
+  for(; c < ncolumns; c++)
+    {
+      while ( s < end && whitespace(*s) ) s++;
+      if ( s >= end ) break;
+      s = parse(s, end, values[c]);
+      if ( s == 0 ) break;
+    }
+  return c;
+}
+
+int SwarmReader::decode(const string& record, int ncolumns, double* values)
+{
+  return decode(record.c_str(), record.c_str() + record.size(),
+		ncolumns, values);
+}
+
+int SwarmReader::read(int nrecords, int ncolumns, vector<double>& values)
+{
+  values.resize((size_t)nrecords * ncolumns);
+
+  vector<const char*> begins;
+  vector<const char*> ends;
+  vector<int> lines;
+  vector<int> found;
+  int r = 0;
+  while ( r < nrecords )
+    {
+      // split the text in the buffer into records...
+      begins.clear();
+      ends.clear();
+      lines.clear();
+      const char* begin;
+      const char* end;
+      size_t size = 0;
+      while ( r + (int)begins.size() < nrecords && _record(begin, end) )
+	{
+	  begins.push_back(begin);
+	  ends.push_back(end);
+	  lines.push_back(_lineno);
+	  size += end - begin;
+	}
+      int n = (int)begins.size();
+
+      // ...and decode them in parallel
+      found.assign(n, ncolumns);
+      ThreadPool& pool = ThreadPool::instance();
+      int ntasks = (int)min((size_t)pool.size(), size / TASKSIZE + 1);
+      ntasks = min(ntasks, max(n, 1));
+      pool.run(ntasks,
+	       [&](int task)
+	       {
+		 int first = (long)n * task / ntasks;
+		 int last  = (long)n * (task + 1) / ntasks;
+		 for(int k=first; k < last; k++)
+		   found[k] = decode(begins[k], ends[k], ncolumns,
+				     &values[(size_t)(r + k) * ncolumns]);
+	       });
+
+      for(int k=0; k < n; k++)
+	if ( found[k] < ncolumns )
+	  {
+	    Error("SwarmReader",
+		  "line %d of %s: found %d values, expected %d:\n%s",
+		  lines[k], _filename.c_str(), found[k], ncolumns,
+		  string(begins[k], ends[k]).c_str());
+	    exit(0);
+	  }
+      r += n;
+
+      if ( r < nrecords && ! _refill() ) break;
+    }
+  values.resize((size_t)r * ncolumns);
+  return r;
+}
@@ -0,0 +1,138 @@
+//--------------------------------------------------------------
+// File: ThreadPool.cc
+// Description: A fixed-size pool of worker threads shared by the
+//              limit calculators.
+//--------------------------------------------------------------
+#include <stdlib.h>
+#include <exception>
+#include "TROOT.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+namespace {
+  // true while the current thread is executing a pool task
+  thread_local bool INTASK = false;
+
+  void execute(function<void()>& job)
+  {
+    bool intask = INTASK;
+    INTASK = true;
+    job();
+    INTASK = intask;
+  }
+};
+
+ThreadPool&
+ThreadPool::instance()
+{
+  static ThreadPool pool(defaultSize());
+  return pool;
+}
+
+int
+ThreadPool::defaultSize()
+{
+  int nthreads = (int)thread::hardware_concurrency();
+  if ( getenv("limits_nthreads") != (char*)0 )
+    nthreads = atoi(getenv("limits_nthreads"));
+  return nthreads > 0 ? nthreads : 1;
+}
+
+ThreadPool::ThreadPool(int nthreads)
+  : _workers(vector<thread>()),
+    _queue(deque<function<void()> >()),
+    _stop(false)
+{
+  // the tasks may use ROOT, e.g., to read histograms in parallel
+  if ( nthreads > 1 ) ROOT::EnableThreadSafety();
+  for(int i=1; i < nthreads; i++)
+    _workers.push_back(thread(&ThreadPool::_work, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    lock_guard<mutex> lock(_mutex);
+    _stop = true;
+  }
+  _ready.notify_all();
+  for(size_t i=0; i < _workers.size(); i++) _workers[i].join();
+}
+
+void
+ThreadPool::run(int ntasks, const function<void(int)>& task)
+{
+  if ( ntasks <= 0 ) return;
+  
+  // run serially if there is nothing to gain or if we are already
+  // inside a pool task
+  if ( _workers.size() == 0 || ntasks == 1 || INTASK )
+    {
+      for(int i=0; i < ntasks; i++) task(i);
+      return;
+    }
+
+  // A task that throws is counted as done, so that run() does not
+  // return while queued jobs still refer to its locals; the first
+  // exception is rethrown once every task has finished.
+  mutex done;
+  condition_variable finished;
+  int remaining = ntasks;
+  exception_ptr error;
+  {
+    lock_guard<mutex> lock(_mutex);
+    for(int i=0; i < ntasks; i++)
+      _queue.push_back([&task, &done, &finished, &remaining, &error, i]()
+		       {
+			 exception_ptr e;
+			 try
+			   {
+			     task(i);
+			   }
+			 catch (...)
+			   {
+			     e = current_exception();
+			   }
+			 lock_guard<mutex> lk(done);
+			 if ( e && ! error ) error = e;
+			 if ( --remaining == 0 ) finished.notify_all();
+		       });
+  }
+  _ready.notify_all();
+
+  // help out while waiting
+  function<void()> job;
+  while ( _next(job) ) execute(job);
+  
+  unique_lock<mutex> lock(done);
+  while ( remaining > 0 ) finished.wait(lock);
+  if ( error ) rethrow_exception(error);
+}
+
+bool
+ThreadPool::_next(function<void()>& job)
+{
+  lock_guard<mutex> lock(_mutex);
+  if ( _queue.empty() ) return false;
+  job = _queue.front();
+  _queue.pop_front();
+  return true;
+}
+
+void
+ThreadPool::_work()
+{
+  while ( true )
+    {
+      function<void()> job;
+      {
+	unique_lock<mutex> lock(_mutex);
+	while ( ! _stop && _queue.empty() ) _ready.wait(lock);
+	if ( _stop && _queue.empty() ) return;
+	job = _queue.front();
+	_queue.pop_front();
+      }
+      execute(job);
+    }
+}
@@ -16,81 +16,113 @@
 // ---------------------------------------------------------------------------
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 #include <stdlib.h>
-#include "TMinuit.h"
 #include "TMath.h"
 #include "Math/WrappedFunction.h"
 #include "Math/RootFinder.h"
 #include "Wald.h"
+#include "BrentMinimizer.h"
 
 ClassImp(Wald);
 
 using namespace std;
 // ---------------------------------------------------------------------------
-// function to be minimized
-namespace {
-  const int MAXITER=10000;
-  const double TOLERANCE=1.e-5;
-  Wald* OBJ=0;
-  void nllFunc(int&    /*npar*/, 
-	       double* /*grad*/, 
-	       double& fval,
-	       double* xval,
-	       int     /*iflag*/)
-  {
-    double poi = xval[0];
-    fval = OBJ->nll(poi);
-  }
-};
-
 Wald::Wald(PDFunction& model,
 	   vector<double>& data,
 	   double poimin,   // minimum value of parameter of interest
 	   double poimax,   // maximum value of parameter of interest
 	   double CL)       // alpha = 1 - CL
   : _model(&model),
+    _cache(model),
     _data(data),
     _poimin(poimin),
     _poimax(poimax),
     _alpha(1-CL),
-    _verbosity(-1)
+    _poihat(0),
+    _poierr(0),
+    _verbosity(-1),
+    _ownpdf(false)
 {
   if ( getenv("limits_verbosity") != (char*)0 )
     _verbosity = atoi(getenv("limits_verbosity"));
   
-  OBJ = this;
   // find best fit value of parameter of interest
   fit();
 }
 
-Wald::~Wald() {}
+Wald::~Wald() 
+{
+  if ( _ownpdf ) delete _model;
+}
+
+LimitCalculator* 
+Wald::clone()
+{
+  PDFunction* model = _model->clone();
+  if ( model == 0 ) return 0;
+
+  Wald* wald = new Wald(*model, _data, _poimin, _poimax, 1-_alpha);
+  wald->_ownpdf = true;
+  return wald;
+}
 
 void Wald::setData(std::vector<double>& d) 
 { 
   _data = d;
+  _cache.clear();
+  fit();
+}
+
+void Wald::clearCache() 
+{ 
+  _cache.clear();
   fit();
 }
 
 double Wald::fit(double guess)
 {
+  // warm start from the previous fit, if there was one, since
+  // successive datasets usually have similar best fit values
+  double stepsize = (_poimax - _poimin)/100;
+  if ( guess < 0 ) 
+    {
+      if ( _poierr > 0 )
+	{
+	  guess = _poihat;
+	  stepsize = _poierr;
+	}
+      else
+	guess = (_poimax + _poimin)/2;
+    }
   _poihat = 0.0;
   _poierr = 0.0;
-  
-  TMinuit minuit(1);
-  minuit.SetPrintLevel(_verbosity);
-  minuit.SetFCN(nllFunc);
-  minuit.SetErrorDef(0.5); // for log-likelihood fit
-
-  int status=0;
-  if ( guess < 0 ) guess = (_poimax + _poimin)/2;
-  double stepsize = (_poimax - _poimin)/2000;
-  minuit.mnparm(0, "poi", guess, stepsize, 
-		_poimin, _poimax, status);
-  double args[2] = {MAXITER, TOLERANCE};
-  minuit.mnexcm("MIGRAD", args, 2, status);
+
+  BrentMinimizer minimizer(_poimin, _poimax);
+  int status;
+  double lnL0, d10, d20;
+  guess = min(max(guess, _poimin), _poimax);
+  if ( _cache.derivatives(_data, guess, lnL0, d10, d20) )
+    {
+      // the model provides derivatives, so use Newton's method, 
+      // which also gives the exact curvature
+      status = minimizer.minimize([&](double poi, double& f, 
+				      double& df, double& d2f)
+				  {
+				    if ( poi == guess )
+				      {
+					f = lnL0; df = d10; d2f = d20;
+				      }
+				    else
+				      _cache.derivatives(_data, poi, f, df, d2f);
+				    f = -f; df = -df; d2f = -d2f;
+				  }, guess);
+    }
+  else
+    status = minimizer.minimize([this](double poi) { return nll(poi); },
+				guess, stepsize);
   if ( status != 0 )
     {
-      _poihat = 0;
       cout << "Wald::fit failed to find MLE" << endl;
       cout << "Wald::fit status  = " << status    << endl;
       cout << "Wald::fit _poimin = " << _poimin  << endl;
@@ -100,8 +132,15 @@ double Wald::fit(double guess)
       cout << "Wald::fit - set _poihat = " << _poihat << endl;
       return _poihat;
     }
-  // get fit result
-  minuit.GetParameter(0, _poihat, _poierr);
+  // get fit result: for a negative log-likelihood the variance is
+  // the inverse of the curvature at the minimum
+  _poihat = minimizer.x();
+  if ( minimizer.curvature() > 0 )
+    _poierr = 1/sqrt(minimizer.curvature());
+  if ( _verbosity > 0 )
+    cout << "Wald::fit poihat = " << _poihat 
+	 << " +/- " << _poierr 
+	 << " (" << minimizer.ncalls() << " calls)" << endl;
   return _poihat;
 }
  
@@ -117,7 +156,7 @@ double Wald::uncertainty()
 
 double Wald::nll(double poi)
 {
-  return -log((*_model)(_data, poi));
+  return -_cache.logLikelihood(_data, poi);
 }
 
 double Wald::operator()(double poi)
@@ -36,7 +36,6 @@
 #include <vector>
 #include <cmath>
 #include <cstdlib> 
-#include "TRandom3.h"
 #include "mnormal.h"
 
 using namespace std;
@@ -60,7 +59,7 @@ mnormal::covariance(TMinuit& minuit, int N)
 }
 
 mnormal::mnormal(std::vector<double>& ai)
-    : random(TRandom3()),
+    : random(CounterRNG()),
       n(ai.size()),
       a(ai)
 {
@@ -72,7 +71,7 @@ mnormal::mnormal(std::vector<double>& ai)
 
 mnormal::mnormal(std::vector<double>& ai,
 		 TMatrixDSym& cov)
-  : random(TRandom3()),
+  : random(CounterRNG()),
     n(ai.size()),
     a(ai)
 {
@@ -93,7 +92,12 @@ mnormal::mnormal(std::vector<double>& ai,
 
 void mnormal::setSeed(int seed)
 {
-  random.SetSeed(seed);
+  random.setSeed(seed);
+}
+
+void mnormal::setStream(long stream)
+{
+  random.setStream(stream);
 }
 
 void mnormal::addRow(vector<double>& row)
@@ -154,7 +158,7 @@ vector<double>& mnormal::getZ() { return z; }
 bool mnormal::generate(std::vector<double>& x)
 {
   bool positive = true;
-  for (int i = 0; i < n; i++) z[i] = random.Gaus();
+  for (int i = 0; i < n; i++) z[i] = random.gaus();
   
   for (int i = 0; i < n; i++)
     {
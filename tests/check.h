@@ -0,0 +1,25 @@
+#ifndef CHECK_H
+#define CHECK_H
+//--------------------------------------------------------------
+// File: check.h
+// Description: Report the checks of a test program, one per line,
+//              and count the failures.
+//--------------------------------------------------------------
+#include <cstdio>
+#include <string>
+
+namespace {
+  int failures = 0;
+
+  /// Print the description of a check and whether it passed.
+  void check(bool ok, std::string what)
+  {
+    printf("%-56s %s\n", what.c_str(), ok ? "ok" : "FAILED");
+    if ( ! ok ) failures++;
+  }
+
+  /// Return the exit status of the test: 0 if every check passed.
+  int checkStatus() { return failures == 0 ? 0 : 1; }
+};
+
+#endif
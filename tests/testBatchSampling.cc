@@ -0,0 +1,213 @@
+//--------------------------------------------------------------
+// File: testBatchSampling.cc
+// Description: Check that variates drawn for several generators at
+//              once are identical to those drawn one generator at a
+//              time from the same streams, and to fixed values, and 
+//              that the batched toys of the models are identical to 
+//              toys generated singly.
+//--------------------------------------------------------------
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "check.h"
+#include "CounterRNG.h"
+#include "MultiPoisson.h"
+#include "MultiPoissonGamma.h"
+#include "MultiPoissonGammaModel.h"
+
+using namespace std;
+
+namespace {
+  // not a multiple of the vector width
+  const int NRNG = 13;
+
+  // number of variates drawn from each generator
+  const int NDRAWS = 200;
+
+  vector<CounterRNG> generators()
+  {
+    vector<CounterRNG> rng(NRNG);
+    for(int t=0; t < NRNG; t++)
+      {
+	rng[t].setSeed(31 + t);
+	rng[t].setStream(1000 + t);
+      }
+    return rng;
+  }
+
+  // return true if the generators are at the same place in their
+  // streams
+  bool sameState(vector<CounterRNG>& a, vector<CounterRNG>& b)
+  {
+    bool ok = true;
+    for(int t=0; t < NRNG; t++) ok = ok && a[t].uniform() == b[t].uniform();
+    return ok;
+  }
+
+  // FNV-1a hash of the bits of the variates, which changes if any
+  // variate changes in its last bit
+  uint64_t hash(uint64_t h, double x)
+  {
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    for(int i=0; i < 8; i++)
+      {
+	h ^= (u >> (8*i)) & 0xff;
+	h *= 0x100000001b3ULL;
+      }
+    return h;
+  }
+  const uint64_t HASHSTART = 0xcbf29ce484222325ULL;
+
+  // The batch is drawn NDRAWS times. Return the first variates and 
+  // the hash of all of them.
+  bool samePoisson(const double* mean, vector<double>& first, uint64_t& h)
+  {
+    vector<CounterRNG> batch = generators();
+    vector<CounterRNG> scalar = generators();
+    vector<double> k(NRNG);
+    bool ok = true;
+    h = HASHSTART;
+    for(int d=0; d < NDRAWS; d++)
+      {
+	CounterRNG::poisson(NRNG, &batch[0], mean, &k[0]);
+	if ( d == 0 ) first = k;
+	for(int t=0; t < NRNG; t++)
+	  {
+	    ok = ok && k[t] == scalar[t].poisson(mean[t]);
+	    h = hash(h, k[t]);
+	  }
+      }
+    return ok && sameState(batch, scalar);
+  }
+
+  bool sameGamma(const double* shape, const double* scale, 
+		 vector<double>& first, uint64_t& h)
+  {
+    vector<CounterRNG> batch = generators();
+    vector<CounterRNG> scalar = generators();
+    vector<double> x(NRNG);
+    bool ok = true;
+    h = HASHSTART;
+    for(int d=0; d < NDRAWS; d++)
+      {
+	CounterRNG::gamma(NRNG, &batch[0], shape, scale, &x[0]);
+	if ( d == 0 ) first = x;
+	for(int t=0; t < NRNG; t++)
+	  {
+	    ok = ok && x[t] == scalar[t].gamma(shape[t], scale[t]);
+	    h = hash(h, x[t]);
+	  }
+      }
+    return ok && sameState(batch, scalar);
+  }
+
+  bool sameValues(const vector<double>& x, const double* expected)
+  {
+    bool ok = true;
+    for(int t=0; t < NRNG; t++) ok = ok && x[t] == expected[t];
+    return ok;
+  }
+
+  // return true if the toys generated together are those generated
+  // one at a time from the same streams
+  bool sameToys(PDFunction& model, double poi)
+  {
+    const long FIRSTSTREAM = 100;
+    model.setSeed(5);
+    vector<double> batch;
+    model.generateBatch(poi, NRNG, batch, FIRSTSTREAM);
+
+    vector<double> scalar;
+    for(int t=0; t < NRNG; t++)
+      {
+	model.setStream(FIRSTSTREAM + t);
+	vector<double>& data = model.generate(poi);
+	scalar.insert(scalar.end(), data.begin(), data.end());
+      }
+    return batch.size() > 0 && batch == scalar;
+  }
+};
+
+int main()
+{
+  // The variates must be the same on every machine, whichever 
+  // version of the SIMD kernels is used (see VectorMath.h), so they
+  // are also compared with fixed values: the first variate of each 
+  // generator and the hash of all the variates.
+  vector<double> first;
+  uint64_t h;
+
+  // means on both sides of the switch between inversion and PTRS at 10
+  double around[NRNG] = {9.5, 9.9, 9.999, 10, 10.001, 10.5, 11,
+			 9.5, 10, 10.5, 9.999, 10.001, 10};
+  check(samePoisson(around, first, h), "poisson: means around 10");
+  double aroundk[NRNG] = {2, 8, 10, 16, 12, 11, 15, 7, 16, 12, 9, 10, 12};
+  check(sameValues(first, aroundk) && h == 0x61e24b333f48c074ULL,
+	"poisson: means around 10, fixed values");
+
+  double spread[NRNG] = {0, 1.e-3, 0.5, 1, 3, 7, 9.99, 10,
+			 25, 57.3, 300, 1.e4, 2.5e5};
+  check(samePoisson(spread, first, h), "poisson: means from 0 to 2.5e5");
+  double spreadk[NRNG] = {0, 0, 0, 3, 4, 7, 13, 10,
+			  35, 61, 293, 9988, 250231};
+  check(sameValues(first, spreadk) && h == 0x44875e0243b7756dULL,
+	"poisson: means from 0 to 2.5e5, fixed values");
+
+  double shape[NRNG] = {0.05, 0.3, 0.5, 0.999, 1, 1.001, 1.5,
+			2, 3.7, 10, 30, 100, 0.7};
+  double scale[NRNG] = {1, 2, 0.5, 1, 3, 1, 0.1,
+			10, 1, 2, 1, 0.25, 4};
+  check(sameGamma(shape, scale, first, h), "gamma: shapes below and above 1");
+  double gammax[NRNG] = {1.1129805239261869e-05, 0.10382197174744799,
+			  0.013054138259239848, 0.65497764631928301,
+			  0.85586764756596012,  0.12662930997010358,
+			  0.070929007380717876, 41.389572771504191,
+			  3.4103911721965563,   15.40807174944892,
+			  37.116688498669383,   25.048721698438285,
+			  4.0371947584924355};
+  check(sameValues(first, gammax) && h == 0xeafcc8d4ec2666e7ULL,
+	"gamma: shapes below and above 1, fixed values");
+
+  // toys of the models, with bin means near 10
+  const int NBINS = 3;
+  vector<double> N(NBINS, 10);
+  {
+    MultiPoisson model(N);
+    for(int k=0; k < 5; k++)
+      {
+	vector<double> S(NBINS), B(NBINS);
+	for(int i=0; i < NBINS; i++)
+	  {
+	    S[i] = 0.5 + 0.2 * k + 0.1 * i;
+	    B[i] = 9.0 + 0.25 * k - 0.5 * i;
+	  }
+	model.add(S, B);
+      }
+    check(sameToys(model, 1), "MultiPoisson: batched toys");
+  }
+  {
+    MultiPoissonGamma model(N);
+    for(int k=0; k < 5; k++)
+      {
+	vector<double> sig(NBINS), dsig(NBINS), bkg(NBINS), dbkg(NBINS);
+	for(int i=0; i < NBINS; i++)
+	  {
+	    sig[i]  = 0.5 + 0.2 * k + 0.1 * i;
+	    dsig[i] = 0.2 * sig[i];
+	    bkg[i]  = 9.0 + 0.25 * k - 0.5 * i;
+	    dbkg[i] = 0.1 * bkg[i];
+	  }
+	model.add(sig, dsig, bkg, dbkg);
+      }
+    check(sameToys(model, 1), "MultiPoissonGamma: batched toys");
+  }
+  {
+    vector<double> x(NBINS, 0.5), a(NBINS, 1), y(NBINS, 19.5), b(NBINS, 2);
+    MultiPoissonGammaModel model(N, x, a, y, b);
+    check(sameToys(model, 0.1), "MultiPoissonGammaModel: batched toys");
+  }
+  return checkStatus();
+}
@@ -0,0 +1,48 @@
+//--------------------------------------------------------------
+// File: testBrentMinimizer.cc
+// Description: Check that the curvature computed by finite
+//              differences at the minimum is accurate whether the
+//              minimum is wide or narrow compared with the interval,
+//              near a boundary or on it.
+//--------------------------------------------------------------
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include "check.h"
+#include "BrentMinimizer.h"
+
+using namespace std;
+
+namespace {
+  // Minimize the negative log-likelihood of n counts for the mean s*x,
+  // and return true if the curvature at the minimum agrees with the
+  // exact one, n/x^2, within a relative error tol.
+  bool poisson(double n, double s, double xmin, double xmax,
+	       double tol=1.e-5)
+  {
+    BrentMinimizer minimizer(xmin, xmax);
+    minimizer.minimize([n, s](double x)
+		       { return s * x - n * log(s * x); },
+		       (xmin + xmax) / 2);
+    double x = minimizer.x();
+    return fabs(minimizer.curvature() * x * x / n - 1) < tol;
+  }
+};
+
+int main()
+{
+  check(poisson(3, 1, 0, 10), "curvature: wide minimum");
+  check(poisson(50, 0.01, 0, 1.e5), "curvature: wide minimum, large x");
+  check(poisson(3, 1000, 0, 1000), "curvature: narrow minimum near a boundary");
+  check(poisson(1, 1, 0, 1000), "curvature: skewed minimum");
+  check(poisson(2, 1, 1.e-3, 2.05), "curvature: minimum near upper boundary");
+
+  // minimum on the lower boundary: the differences are one-sided
+  {
+    BrentMinimizer minimizer(0, 10);
+    minimizer.minimize([](double x) { return (x + 1) * (x + 1); }, 5);
+    check(minimizer.x() == 0 && fabs(minimizer.curvature() - 2) < 1.e-5,
+	  "curvature: minimum on a boundary");
+  }
+  return checkStatus();
+}
@@ -0,0 +1,100 @@
+//--------------------------------------------------------------
+// File: testCounterRNG.cc
+// Description: Check the Philox4x32-10 generator against the known
+//              answers of the Random123 distribution, and check that
+//              the numbers of a stream are the blocks of its counter,
+//              whether they are computed one generator at a time or
+//              for several generators at once.
+//--------------------------------------------------------------
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "check.h"
+#include "CounterRNG.h"
+
+using namespace std;
+
+namespace {
+  bool philox(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3,
+	      uint32_t k0, uint32_t k1,
+	      uint32_t b0, uint32_t b1, uint32_t b2, uint32_t b3)
+  {
+    uint32_t counter[4] = {c0, c1, c2, c3};
+    uint32_t key[2] = {k0, k1};
+    uint32_t block[4];
+    CounterRNG::philox(counter, key, block);
+    return block[0] == b0 && block[1] == b1 &&
+      block[2] == b2 && block[3] == b3;
+  }
+
+  // return true if the next n numbers of rng are the blocks of
+  // counters 0, 1,... of its stream, keyed by its seed
+  bool sameBlocks(CounterRNG& rng, int n)
+  {
+    uint64_t seed = rng.seed();
+    uint64_t stream = rng.stream();
+    uint32_t key[2] = {(uint32_t)seed, (uint32_t)(seed >> 32)};
+    uint32_t block[4];
+    for(int i=0; i < n; i++)
+      {
+	uint64_t c = i / 4;
+	uint32_t counter[4] = {(uint32_t)c, (uint32_t)(c >> 32),
+			       (uint32_t)stream, (uint32_t)(stream >> 32)};
+	if ( i % 4 == 0 ) CounterRNG::philox(counter, key, block);
+	if ( rng.next() != block[i % 4] ) return false;
+      }
+    return true;
+  }
+};
+
+int main()
+{
+  // known answers for Philox4x32-10 (Random123, kat_vectors)
+  check(philox(0, 0, 0, 0, 0, 0,
+	       0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8),
+	"philox: zero counter and key");
+  check(philox(0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff,
+	       0xffffffff, 0xffffffff,
+	       0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd),
+	"philox: all-ones counter and key");
+  check(philox(0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344,
+	       0xa4093822, 0x299f31d0,
+	       0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1),
+	"philox: digits of pi");
+
+  // a generator returns the blocks of its stream
+  const int NUMBERS = 3 * CounterRNG::BUFFERSIZE + 5;
+  {
+    CounterRNG rng(0x123456789abcdefULL, 0xfedcba987654321ULL);
+    check(sameBlocks(rng, NUMBERS), "stream: numbers are the counter blocks");
+
+    rng.setStream(7);
+    check(sameBlocks(rng, NUMBERS), "stream: setStream restarts the stream");
+  }
+
+  // several generators, their buffers filled together, return the
+  // same numbers. The number of generators is not a multiple of the
+  // vector width, and some have used part of their buffers.
+  {
+    const int NRNG = 13;
+    vector<CounterRNG> rng(NRNG);
+    for(int t=0; t < NRNG; t++)
+      {
+	rng[t].setSeed(1000 + t);
+	rng[t].setStream(t * 0x100000001ULL);
+      }
+    vector<CounterRNG> copy(rng);
+    for(int t=0; t < NRNG; t += 3) rng[t].next();
+    CounterRNG::fill(NRNG, &rng[0]);
+    bool ok = true;
+    for(int t=0; t < NRNG; t++)
+      {
+	if ( t % 3 == 0 ) copy[t].next();
+	for(int i=0; i < NUMBERS; i++)
+	  ok = ok && rng[t].next() == copy[t].next();
+      }
+    check(ok, "fill: same numbers as one generator at a time");
+  }
+  return checkStatus();
+}
@@ -0,0 +1,207 @@
+//--------------------------------------------------------------
+// File: testStreamingQuantiles.cc
+// Description: Compare the quantiles of StreamingQuantiles with the
+//              exact percentiles of a fixed sample, below and above
+//              the number of values kept, and check that an ensemble
+//              of limits stops once the requested tolerance is met,
+//              at the same toy whatever the number of threads.
+//--------------------------------------------------------------
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "check.h"
+#include "CounterRNG.h"
+#include "StreamingQuantiles.h"
+#include "MultiPoissonGammaModel.h"
+#include "Wald.h"
+#include "Bayes.h"
+#include "ExpectedLimits.h"
+
+using namespace std;
+
+namespace {
+  // fixed sample of standard normal variates
+  vector<double> sample(int n)
+  {
+    CounterRNG rng(12345);
+    vector<double> x(n);
+    for(int i=0; i < n; i++) x[i] = rng.gaus();
+    return x;
+  }
+
+  // percentile of sorted values, interpolated between order statistics
+  // as in StreamingQuantiles
+  double percentile(const vector<double>& v, double p)
+  {
+    int    n = (int)v.size();
+    double q = p * n;
+    int    i = min((int)q, n-1);
+    int    j = min(i+1, n-1);
+    double x = q - i;
+    return x * v[j] + (1 - x) * v[i];
+  }
+
+  // largest difference between the quantiles of a stream and the
+  // exact percentiles of the same values, in units of the estimated
+  // uncertainties if scaled is true
+  double compare(const vector<double>& prob, int n,
+		 int exactsize, bool scaled, bool& exact)
+  {
+    vector<double> x = sample(n);
+    StreamingQuantiles quantiles(prob, exactsize);
+    for(int i=0; i < n; i++) quantiles.add(x[i]);
+    exact = quantiles.exact();
+
+    sort(x.begin(), x.end());
+    vector<double> q = quantiles.quantiles();
+    vector<double> dq = quantiles.errors();
+    double worst = 0;
+    for(size_t ii=0; ii < prob.size(); ii++)
+      {
+	double d = fabs(q[ii] - percentile(x, prob[ii]));
+	if ( scaled ) d /= dq[ii];
+	worst = max(worst, d);
+      }
+    return worst;
+  }
+
+  // ensemble used to check the tolerance
+  const double TOLERANCE = 0.05;
+  const int ENSEMBLESIZE = 20000;
+
+  // Compute the quantiles of the ensemble, with the tolerance, using
+  // a pool of nthreads threads and the Wald or the Bayes calculator. 
+  // The pool is created once per process, so the ensemble is computed
+  // in a child process. Return the number of toys followed by the 
+  // quantiles.
+  vector<double> ensemble(int nthreads, int nquantiles, bool bayes)
+  {
+    vector<double> result(1 + nquantiles);
+    int fd[2];
+    if ( pipe(fd) != 0 ) return vector<double>();
+    fflush(stdout);
+    pid_t pid = fork();
+    if ( pid == 0 )
+      {
+	close(fd[0]);
+	char value[16];
+	sprintf(value, "%d", nthreads);
+	setenv("limits_nthreads", value, 1);
+
+	MultiPoissonGammaModel model(5, 10, 5, 20, 4);
+	vector<double> data(1, 5);
+	Wald wald(model, data, 0, 20);
+	Bayes posterior(model, data, 0, 20);
+	LimitCalculator* calculator = &wald;
+	if ( bayes ) calculator = &posterior;
+	ExpectedLimits limits(*calculator, ENSEMBLESIZE);
+	limits.setTolerance(TOLERANCE);
+	vector<double> q = limits(0);
+	result[0] = limits.ntoys();
+	copy(q.begin(), q.end(), result.begin() + 1);
+	ssize_t n = write(fd[1], &result[0], result.size() * sizeof(double));
+	_exit(n == (ssize_t)(result.size() * sizeof(double)) ? 0 : 1);
+      }
+    close(fd[1]);
+    size_t size = result.size() * sizeof(double);
+    size_t n = 0;
+    while ( n < size )
+      {
+	ssize_t m = read(fd[0], (char*)&result[0] + n, size - n);
+	if ( m <= 0 ) break;
+	n += m;
+      }
+    close(fd[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if ( n < size || ! WIFEXITED(status) || WEXITSTATUS(status) != 0 )
+      return vector<double>();
+    return result;
+  }
+};
+
+int main()
+{
+  double p[] = {0.025, 0.16, 0.5, 0.84, 0.975};
+  vector<double> prob(p, p + sizeof(p) / sizeof(p[0]));
+  const int EXACTSIZE = StreamingQuantiles::EXACTSIZE;
+  bool exact;
+
+  // below the threshold, the quantiles are the exact percentiles
+  double d = compare(prob, 1000, EXACTSIZE, false, exact);
+  check(exact, "1000 values: quantiles are exact");
+  check(d < 1.e-12, "1000 values: quantiles equal percentiles");
+
+  d = compare(prob, EXACTSIZE, EXACTSIZE, false, exact);
+  check(exact && d < 1.e-12, "4096 values: quantiles equal percentiles");
+
+  // above the threshold, P^2 agrees with the exact percentiles to
+  // within the Monte Carlo uncertainty
+  d = compare(prob, EXACTSIZE + 1, EXACTSIZE, true, exact);
+  check(!exact && d < 1, "4097 values: P^2 agrees with percentiles");
+
+  d = compare(prob, 100000, EXACTSIZE, true, exact);
+  check(!exact && d < 1, "100000 values: P^2 agrees with percentiles");
+
+  // the estimated uncertainties are close to sqrt(p (1 - p) / n) / f(q)
+  // for a standard normal density f. In the tails, the difference 
+  // between the neighboring midpoints underestimates dq/dp, by about 
+  // a third at p = 0.025.
+  {
+    int n = 100000;
+    vector<double> x = sample(n);
+    StreamingQuantiles quantiles(prob);
+    for(int i=0; i < n; i++) quantiles.add(x[i]);
+    vector<double> q = quantiles.quantiles();
+    vector<double> dq = quantiles.errors();
+    bool ok = true;
+    for(size_t ii=0; ii < prob.size(); ii++)
+      {
+	double f = exp(-q[ii]*q[ii]/2) / sqrt(2*M_PI);
+	double expected = sqrt(prob[ii] * (1 - prob[ii]) / n) / f;
+	ok = ok && dq[ii] > expected / 2 && dq[ii] < 2 * expected;
+      }
+    check(ok, "100000 values: uncertainties");
+  }
+
+  // An ensemble with a tolerance stops at the same toy, with the same
+  // quantiles, whatever the number of threads. This is checked first,
+  // in child processes, since the pool of threads of this process is
+  // created by the first ensemble.
+  for(int bayes=0; bayes < 2; bayes++)
+    {
+      vector<double> one  = ensemble(1, (int)prob.size(), bayes);
+      vector<double> many = ensemble(3, (int)prob.size(), bayes);
+      check(one.size() > 0 && one == many, 
+	    string(bayes ? "Bayes" : "Wald") + 
+	    " tolerance: same quantiles on 1 and 3 threads");
+    }
+
+  // an ensemble stops early once every quantile is known to within
+  // the tolerance, and runs to the end if the tolerance is not met
+  {
+    MultiPoissonGammaModel model(5, 10, 5, 20, 4);
+    vector<double> data(1, 5);
+    Wald wald(model, data, 0, 20);
+
+    ExpectedLimits limits(wald, ENSEMBLESIZE);
+    limits.setTolerance(TOLERANCE);
+    limits(0);
+    vector<double> errors = limits.errors();
+    double maxerror = *max_element(errors.begin(), errors.end());
+    check(limits.ntoys() < ENSEMBLESIZE, "tolerance: ensemble stops early");
+    check(maxerror < TOLERANCE, "tolerance: uncertainties below tolerance");
+
+    const int SMALLSIZE = 300;
+    ExpectedLimits all(wald, SMALLSIZE);
+    all.setTolerance(1.e-6);
+    all(0);
+    check(all.ntoys() == SMALLSIZE, "tolerance: unmet tolerance uses all toys");
+  }
+  return checkStatus();
+}
@@ -0,0 +1,168 @@
+//--------------------------------------------------------------
+// File: testSwarmFile.cc
+// Description: Write binary swarm files, read them back, and check
+//              that damaged files are rejected with an error rather
+//              than read out of bounds.
+//--------------------------------------------------------------
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include "check.h"
+#include "MultiPoisson.h"
+#include "MultiPoissonGamma.h"
+
+using namespace std;
+
+namespace {
+  // byte offsets of the header fields (see SwarmFile.cc)
+  const int DTYPE=16;
+  const int ENDIAN=20;
+  const int STRIDE=32;
+  const int LENGTH=168;
+
+  string tempName(string name)
+  {
+    ostringstream os;
+    os << P_tmpdir << "/" << name << "." << getpid() << ".bin";
+    return os.str();
+  }
+
+  string readFile(string filename)
+  {
+    ifstream inp(filename.c_str(), ios::binary);
+    return string(istreambuf_iterator<char>(inp), istreambuf_iterator<char>());
+  }
+
+  void writeFile(string filename, const string& bytes)
+  {
+    ofstream out(filename.c_str(), ios::binary);
+    out.write(bytes.data(), bytes.size());
+  }
+
+  template <class T>
+  void poke(string& bytes, int offset, T value)
+  {
+    memcpy(&bytes[offset], &value, sizeof(value));
+  }
+
+  // return true if reading the file exits with an error, in a child
+  // process, rather than returning a model or crashing
+  template <class Model>
+  bool rejected(const string& bytes)
+  {
+    string filename = tempName("testSwarmFile_bad");
+    writeFile(filename, bytes);
+    fflush(stdout);
+    pid_t pid = fork();
+    if ( pid == 0 )
+      {
+	Model model(filename);
+	_exit(2);
+      }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    unlink(filename.c_str());
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+};
+
+int main()
+{
+  const int NBINS=3;
+  const int NPOINTS=13;   // not a multiple of the stride padding
+  vector<double> N(NBINS);
+  N[0] = 2; N[1] = 5; N[2] = 1;
+
+  // multi-Poisson model
+  MultiPoisson mp(N);
+  for(int k=0; k < NPOINTS; k++)
+    {
+      vector<double> S(NBINS), B(NBINS);
+      for(int i=0; i < NBINS; i++)
+	{
+	  S[i] = 0.5 + 0.1 * k + 0.3 * i;
+	  B[i] = 1.0 + 0.05 * k * i;
+	}
+      mp.add(S, B);
+    }
+  string mpfile = tempName("testSwarmFile_mp");
+  mp.writeBinary(mpfile);
+  {
+    MultiPoisson copy(mpfile);
+    bool same = true;
+    for(double mu=0; mu < 5; mu += 0.5)
+      same = same && copy.logLikelihood(N, mu) == mp.logLikelihood(N, mu);
+    check(same, "MultiPoisson round trip: likelihood");
+    check(copy.asimov(1.5) == mp.asimov(1.5), 
+	  "MultiPoisson round trip: Asimov data");
+  }
+
+  // multi-Poisson-gamma model
+  MultiPoissonGamma mpg(N);
+  for(int k=0; k < NPOINTS; k++)
+    {
+      vector<double> sig(NBINS), dsig(NBINS), bkg(NBINS), dbkg(NBINS);
+      for(int i=0; i < NBINS; i++)
+	{
+	  sig[i]  = 0.5 + 0.1 * k + 0.3 * i;
+	  dsig[i] = 0.1 * sig[i];
+	  bkg[i]  = 1.0 + 0.05 * k * i;
+	  dbkg[i] = 0.2 * bkg[i];
+	}
+      mpg.add(sig, dsig, bkg, dbkg);
+    }
+  string mpgfile = tempName("testSwarmFile_mpg");
+  mpg.writeBinary(mpgfile);
+  {
+    MultiPoissonGamma copy(mpgfile);
+    bool same = true;
+    for(double mu=0; mu < 5; mu += 0.5)
+      same = same && copy.logLikelihood(N, mu) == mpg.logLikelihood(N, mu);
+    check(same, "MultiPoissonGamma round trip: likelihood");
+  }
+
+  // damaged files
+  string good = readFile(mpfile);
+  check(! rejected<MultiPoisson>(good), "intact file accepted");
+
+  check(rejected<MultiPoisson>(good.substr(0, good.size() / 2)),
+	"truncated file rejected");
+
+  string bad = good;
+  poke<uint32_t>(bad, ENDIAN, 0x04030201);
+  check(rejected<MultiPoisson>(bad), "foreign byte order rejected");
+
+  bad = good;
+  poke<uint32_t>(bad, DTYPE, 4);
+  check(rejected<MultiPoisson>(bad), "float values rejected");
+
+  check(rejected<MultiPoissonGamma>(good), "wrong model rejected");
+
+  bad = good;
+  poke<uint32_t>(bad, STRIDE, 8);
+  check(rejected<MultiPoisson>(bad), "stride smaller than points rejected");
+
+  bad = good;
+  poke<uint64_t>(bad, LENGTH + 8, 1);
+  check(rejected<MultiPoisson>(bad), "short section rejected");
+
+  bad = good;
+  poke<uint64_t>(bad, LENGTH + 8, ~(uint64_t)0 / 4);
+  check(rejected<MultiPoisson>(bad), "overflowing section length rejected");
+
+  bad = readFile(mpgfile);
+  poke<uint64_t>(bad, LENGTH, 2);
+  check(rejected<MultiPoissonGamma>(bad), "short count section rejected");
+
+  unlink(mpfile.c_str());
+  unlink(mpgfile.c_str());
+  return checkStatus();
+}